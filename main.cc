@@ -1,6 +1,8 @@
 #include <cstring>
 #include <iostream>
 #include "Tokenizer.h"
+#include "Compiler.h"
+#include "Optimizer.h"
 #include "Context.h"
 #include "Parser.h"
 #include "Environment.h"
@@ -29,9 +31,15 @@ int main(int argc, char **argv) {
 	    log.logLn("使い方は間違い");
 		return 1;
 	}
-	long freq = 100000;
+	long freq = 0;
+	double growthFactor = 0;
+	unsigned markThreads = 1;
+	long maxCallDepth = 0;
 	bool print_ast = false;
 	bool print_lex = false;
+	bool print_gc = false;
+	bool print_code = false;
+	bool bytecode = false;
 	for (int i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-d") == 0) {
 			i++;
@@ -41,6 +49,15 @@ int main(int argc, char **argv) {
 			if (strcmp(argv[i], "lex") == 0) {
 				print_lex = true;
 			}
+			if (strcmp(argv[i], "gc") == 0) {
+				print_gc = true;
+			}
+			if (strcmp(argv[i], "code") == 0) {
+				print_code = true;
+			}
+		}
+		if (strcmp(argv[i], "-b") == 0) {
+			bytecode = true;
 		}
 		if (strcmp(argv[i], "-f") == 0) {
 			i++;
@@ -49,6 +66,18 @@ int main(int argc, char **argv) {
                     ->logLong(freq)
                     ->logEndl();
 		}
+		if (strcmp(argv[i], "-gc") == 0) {
+			i++;
+			growthFactor = atof(argv[i]);
+		}
+		if (strcmp(argv[i], "-gt") == 0) {
+			i++;
+			markThreads = (unsigned) atol(argv[i]);
+		}
+		if (strcmp(argv[i], "-s") == 0) {
+			i++;
+			maxCallDepth = atol(argv[i]);
+		}
 		if (strcmp(argv[i], "-h") == 0) {
             log
                     .log("狸語プログラミング言語")->logEndl()
@@ -59,7 +88,13 @@ int main(int argc, char **argv) {
 			        ->log("パラメーター：")->logEndl()
 			        ->log("　-d lex：lexerの結果を表示（ディバギング）")->logEndl()
 			        ->log("　-d ast：parserの結果を表示（ディバギング）")->logEndl()
-			        ->log("　-f 数字：evalの何回目の時にメモリを掃除（デフォルトは十万）")->logEndl()
+			        ->log("　-d gc：終了時にメモリ掃除の統計を表示")->logEndl()
+			        ->log("　-d code：バイトコードを表示（ディバギング）")->logEndl()
+			        ->log("　-b：構文木ではなくバイトコードで実行")->logEndl()
+			        ->log("　-f 数字：evalの何回目の時に必ずメモリを掃除（ディバギング）")->logEndl()
+			        ->log("　-gc 数字：メモリ掃除の後でヒープの成長係数（デフォルトは２）")->logEndl()
+			        ->log("　-gt 数字：メモリ掃除のマークに使うスレッド数（デフォルトは１）")->logEndl()
+			        ->log("　-s 数字：関数呼び出しの最大の深さ（デフォルトは１００００００）")->logEndl()
 			        ->log("　-h：このメッセジを表示")->logEndl();
 			return 0;
 		}
@@ -93,7 +128,29 @@ int main(int argc, char **argv) {
 	}
 
 	Context context;
+	Optimizer(&context).optimize(tree);
+
+	if (print_code) {
+		Compiler compiler;
+		Code *code = compiler.compile(tree);
+		log.logLn("BYTECODE:");
+		log.logLn("---------------------");
+		log.logLn(code->toString());
+		delete code;
+		delete tree;
+		context.cleanup();
+		return 1;
+	}
+
+	context.setBytecode(bytecode);
 	context.setFrequency(freq);
+	if (growthFactor > 0) {
+		context.setGrowthFactor(growthFactor);
+	}
+	context.setMarkThreads(markThreads);
+	if (maxCallDepth > 0) {
+		context.setMaxCallDepth((size_t) maxCallDepth);
+	}
     FilesystemImpl filesystem;
     auto *env = new Environment(&context, &filesystem);
 	env->bind(
@@ -103,6 +160,11 @@ int main(int argc, char **argv) {
 	evalPinponStarter(env);
 	env->eval(tree);
 
+	if (print_gc) {
+		log.logLn("GC 統計:");
+		log.log(context.getStats().toString());
+	}
+
 	delete tree;
 	context.cleanup();
     return 0;
@@ -114,5 +176,6 @@ void evalPinponStarter(Environment *env) {
 	auto tokenizer = InputSourceTokenizer(&source);
 	auto parser = Parser(&tokenizer, &log);
 	SyntaxNode *tree = parser.run();
+	Optimizer(env->context).optimize(tree);
 	env->eval(tree);
 }
@@ -1,9 +1,10 @@
 #include "TanukiServerREPL.h"
+#include "Optimizer.h"
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
-TanukiServerREPL::TanukiServerREPL() {
+TanukiServerREPL::TanukiServerREPL(bool bytecode) : bytecode(bytecode) {
     m_endpoint.set_error_channels(websocketpp::log::elevel::all);
     m_endpoint.set_access_channels(websocketpp::log::alevel::all ^ websocketpp::log::alevel::frame_payload);
     m_endpoint.set_reuse_addr(true);
@@ -48,6 +49,9 @@ void TanukiServerREPL::handleMessage(websocketpp::connection_hdl hdl, server::me
     } else if (parsed["messageType"] == "ping"){
         m_endpoint.send(hdl, "{\"messageType\": \"pong\"}", msg->get_opcode());
         return;
+    } else if (parsed["messageType"] == "gcStats"){
+        sendGCStats(hdl, msg->get_opcode());
+        return;
     } else if (parsed["messageType"] == "code" | parsed["messageType"] == "file"){
         inputRaw = parsed["code"];
     }
@@ -55,17 +59,15 @@ void TanukiServerREPL::handleMessage(websocketpp::connection_hdl hdl, server::me
     if (parsed["messageType"] == "file") {
         oneLine = false;
     }
-    wstring input = decodeUTF8(inputRaw);
 
     ConsoleLogger log;
-    auto source = StringInputSource(input.c_str());
+    auto source = UTF8InputSource(inputRaw);
     auto tokenizer = InputSourceTokenizer(&source);
     auto parser = Parser(&tokenizer, &log);
-    SyntaxNode *tree = parser.run();
-    if (oneLine) {
-        tree = tree->children[0];
-    }
-    auto result = environments[hdl]->eval(tree);
+    SyntaxNode *program = parser.run();
+    Optimizer(environments[hdl]->context).optimize(program);
+    SyntaxNode *tree = oneLine ? program->children[0] : program;
+    auto result = environments[hdl]->context->completedValue(environments[hdl]->eval(tree));
 
     stringstream out;
     out << R"({)"
@@ -74,5 +76,32 @@ void TanukiServerREPL::handleMessage(websocketpp::connection_hdl hdl, server::me
         << R"(})";
     m_endpoint.send(hdl, out.str(), msg->get_opcode());
 
-    delete tree;
+    if (bytecode) {
+        delete program;
+    } else {
+        // Functions the tree walker made point into the tree.
+        programs[hdl].push_back(program);
+    }
+}
+
+void TanukiServerREPL::sendGCStats(websocketpp::connection_hdl hdl, websocketpp::frame::opcode::value opcode) {
+    auto stats = environments[hdl]->context->getStats();
+    json liveValues = json::object();
+    for (size_t type = 0; type < ValueTypeCount; type++) {
+        liveValues[ValueTypeStrings[type]] = stats.liveValues[type];
+    }
+    json out = {
+            {"messageType", "gcStats"},
+            {"collections", stats.collections},
+            {"minorCollections", stats.minorCollections},
+            {"totalPauseMs", stats.totalPauseMs},
+            {"maxPauseMs", stats.maxPauseMs},
+            {"pauseHistogram", vector<long>(begin(stats.pauseHistogram), end(stats.pauseHistogram))},
+            {"liveBytes", stats.liveBytes},
+            {"liveValues", liveValues},
+            {"liveEnvironments", stats.liveEnvironments},
+            {"heapBytes", stats.heapBytes},
+            {"peakHeapBytes", stats.peakHeapBytes},
+    };
+    m_endpoint.send(hdl, out.dump(), opcode);
 }
@@ -21,16 +21,23 @@ class TanukiServerREPL {
 public:
     std::set<websocketpp::connection_hdl, std::owner_less<websocketpp::connection_hdl>> connectionSet;
     std::map<websocketpp::connection_hdl, Environment*, std::owner_less<websocketpp::connection_hdl>> environments;
+    // Messages run by the tree walker, kept until the connection closes.
+    std::map<websocketpp::connection_hdl, vector<SyntaxNode*>, std::owner_less<websocketpp::connection_hdl>> programs;
 
-    TanukiServerREPL();
+    // With `bytecode`, sessions run on the bytecode VM.
+    explicit TanukiServerREPL(bool bytecode = false);
 
     void handleMessage(websocketpp::connection_hdl hdl, server::message_ptr msg);
 
+    // Replies with the collector statistics of the connection's session.
+    void sendGCStats(websocketpp::connection_hdl hdl, websocketpp::frame::opcode::value opcode);
+
     void handleOpen(websocketpp::connection_hdl hdl) {
         cout << m_endpoint.get_con_from_hdl(hdl)->get_request_header("Cookie") << endl;
         auto *connectionLogger = new ServerLogger(&m_endpoint, hdl);
-        environments[hdl] = new Environment(new Context(), nullptr, connectionLogger);
-        environments[hdl]->context->setFrequency(10);
+        auto *context = new Context();
+        context->setBytecode(bytecode);
+        environments[hdl] = new Environment(context, nullptr, connectionLogger);
         environments[hdl]->exitHandler = connectionLogger;
         evalPinponStarter(environments[hdl]);
 
@@ -47,6 +54,10 @@ public:
         auto env = environments[hdl];
         auto con = env->context;
         auto log = env->logger;
+        for (auto program : programs[hdl]) {
+            delete program;
+        }
+        programs.erase(hdl);
         con->cleanup();
         delete con;
         delete log;
@@ -81,6 +92,7 @@ public:
 
 private:
     server m_endpoint;
+    bool bytecode;
 };
 
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <signal.h>
+#include <cstring>
 
 #include "TanukiServerREPL.h"
 
@@ -8,8 +9,14 @@ void shutdownInterrupt(int) {
     running_server->stop();
 }
 
-int main() {
-    TanukiServerREPL s;
+int main(int argc, char **argv) {
+    bool bytecode = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0) {
+            bytecode = true;
+        }
+    }
+    TanukiServerREPL s(bytecode);
     running_server = &s;
     signal(SIGINT, shutdownInterrupt);
     signal(SIGTERM, shutdownInterrupt);
@@ -1,5 +1,6 @@
 #include "starterEvaluator.h"
 #include "CoreFunctions.h"
+#include "Optimizer.h"
 
 void evalPinponStarter(Environment *env) {
     ConsoleLogger log;
@@ -7,5 +8,6 @@ void evalPinponStarter(Environment *env) {
     auto tokenizer = InputSourceTokenizer(&source);
     auto parser = Parser(&tokenizer, &log);
     SyntaxNode *tree = parser.run();
+    Optimizer(env->context).optimize(tree);
     env->eval(tree);
 }
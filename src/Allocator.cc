@@ -0,0 +1,169 @@
+#include "Allocator.h"
+
+#include <cstdlib>
+#include <new>
+
+// Under AddressSanitizer free slots are poisoned (apart from the free list
+// link) so that use-after-free of pooled objects is still reported.
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define POISON_SLOT(slot, size) \
+    ASAN_POISON_MEMORY_REGION((char *) (slot) + sizeof(void *), (size) - sizeof(void *))
+#define UNPOISON_SLOT(slot, size) ASAN_UNPOISON_MEMORY_REGION(slot, size)
+#else
+#define POISON_SLOT(slot, size)
+#define UNPOISON_SLOT(slot, size)
+#endif
+
+static size_t roundUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+Slab *Slab::create(SlabPool *pool, size_t slotSize) {
+    void *memory;
+#ifdef _WIN32
+    memory = _aligned_malloc(SIZE, SIZE);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+#else
+    if (posix_memalign(&memory, SIZE, SIZE) != 0) {
+        throw std::bad_alloc();
+    }
+#endif
+    auto slab = (Slab *) memory;
+    slab->pool = pool;
+    slab->slots = (char *) memory + roundUp(sizeof(Slab), 64);
+    size_t slotCount = (SIZE - roundUp(sizeof(Slab), 64)) / slotSize;
+    slab->slotCount = (uint32_t) (slotCount < MAX_SLOTS ? slotCount : MAX_SLOTS);
+    slab->liveCount = 0;
+    for (auto &word : slab->used) {
+        word = 0;
+    }
+    return slab;
+}
+
+void Slab::destroy(Slab *slab) {
+    UNPOISON_SLOT(slab, SIZE);
+#ifdef _WIN32
+    _aligned_free(slab);
+#else
+    free(slab);
+#endif
+}
+
+size_t Slab::indexOf(void *slot) const {
+    return ((char *) slot - slots) / pool->getSlotSize();
+}
+
+SlabPool::SlabPool(size_t objectSize, void (*destroy)(void *))
+        : slotSize(roundUp(objectSize, 16)), destroy(destroy) {}
+
+SlabPool::~SlabPool() {
+    clear();
+}
+
+void SlabPool::pushFree(void *slot) {
+    *(void **) slot = freeList;
+    freeList = slot;
+    POISON_SLOT(slot, slotSize);
+}
+
+void SlabPool::grow() {
+    auto slab = Slab::create(this, slotSize);
+    slabs.push_back(slab);
+    for (size_t index = slab->slotCount; index-- > 0;) {
+        pushFree(slab->slots + index * slotSize);
+    }
+}
+
+void SlabPool::pushFreeSlots(Slab *slab) {
+    for (size_t index = slab->slotCount; index-- > 0;) {
+        if (!slab->isUsed(index)) {
+            pushFree(slab->slots + index * slotSize);
+        }
+    }
+}
+
+void SlabPool::sweepLazily(bool (*isDead)(void *, void *), void *arg) {
+    lazyIsDead = isDead;
+    lazyIsDeadArg = arg;
+    sweepCursor = 0;
+    freeList = nullptr;
+}
+
+bool SlabPool::sweepNext() {
+    if (!lazyIsDead) {
+        return false;
+    }
+    while (sweepCursor < slabs.size()) {
+        auto slab = slabs[sweepCursor];
+        sweepSlab(slab, [this](void *slot) { return lazyIsDead(slot, lazyIsDeadArg); });
+        if (slab->liveCount == 0 && slabs.size() > 1) {
+            // Everything past the cursor is unswept, so the last slab can
+            // take this one's place.
+            Slab::destroy(slab);
+            slabs[sweepCursor] = slabs.back();
+            slabs.pop_back();
+            continue;
+        }
+        sweepCursor++;
+        pushFreeSlots(slab);
+        if (sweepCursor == slabs.size()) {
+            lazyIsDead = nullptr;
+        }
+        return true;
+    }
+    lazyIsDead = nullptr;
+    return false;
+}
+
+void *SlabPool::allocate() {
+    while (!freeList && sweepNext()) {
+    }
+    if (!freeList) {
+        grow();
+    }
+    void *slot = freeList;
+    freeList = *(void **) slot;
+    UNPOISON_SLOT(slot, slotSize);
+    auto slab = Slab::of(slot);
+    size_t index = slab->indexOf(slot);
+    slab->used[index / 64] |= (uint64_t) 1 << (index % 64);
+    slab->liveCount++;
+    liveCount++;
+    return slot;
+}
+
+void SlabPool::release(void *slot) {
+    auto slab = Slab::of(slot);
+    auto pool = slab->pool;
+    if (pool->destroy) {
+        pool->destroy(slot);
+    }
+    size_t index = slab->indexOf(slot);
+    slab->used[index / 64] &= ~((uint64_t) 1 << (index % 64));
+    slab->liveCount--;
+    pool->liveCount--;
+    pool->pushFree(slot);
+}
+
+void SlabPool::clear() {
+    for (auto *slab : slabs) {
+        if (destroy) {
+            for (size_t word = 0; word * 64 < slab->slotCount; word++) {
+                uint64_t bits = slab->used[word];
+                while (bits) {
+                    size_t bit = lowestSetBit(bits);
+                    bits &= bits - 1;
+                    destroy(slab->slots + (word * 64 + bit) * slotSize);
+                }
+            }
+        }
+        Slab::destroy(slab);
+    }
+    slabs.clear();
+    freeList = nullptr;
+    lazyIsDead = nullptr;
+    liveCount = 0;
+}
@@ -0,0 +1,158 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+inline size_t lowestSetBit(uint64_t bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return index;
+#else
+    return (size_t) __builtin_ctzll(bits);
+#endif
+}
+
+class SlabPool;
+
+// A fixed-size, size-aligned block of equally sized slots. Because slabs are
+// aligned to their own size, the slab (and so the pool) owning any slot can
+// be found by masking the slot address.
+struct Slab {
+    static const size_t SIZE = 64 * 1024;
+    static const size_t MAX_SLOTS = 4096;
+
+    SlabPool *pool;
+    char *slots;
+    uint32_t slotCount;
+    uint32_t liveCount;
+    uint64_t used[MAX_SLOTS / 64];
+
+    static Slab *create(SlabPool *pool, size_t slotSize);
+
+    static void destroy(Slab *slab);
+
+    static Slab *of(void *slot) {
+        return (Slab *) ((uintptr_t) slot & ~(uintptr_t) (SIZE - 1));
+    }
+
+    size_t indexOf(void *slot) const;
+
+    bool isUsed(size_t index) const { return (used[index / 64] >> (index % 64)) & 1; }
+};
+
+// Allocates objects of a single size class out of slabs. Objects are
+// constructed with placement new by the caller and destroyed through the
+// `destroy` hook, which is skipped for trivially destructible classes so
+// that dropping the pool costs O(slabs).
+class SlabPool {
+    vector<Slab *> slabs;
+    void *freeList = nullptr;
+    size_t slotSize;
+    void (*destroy)(void *);
+    size_t liveCount = 0;
+    // Lazy sweep in progress: slabs from `sweepCursor` on may still hold
+    // dead objects and none of their free slots are on the free list.
+    bool (*lazyIsDead)(void *slot, void *arg) = nullptr;
+    void *lazyIsDeadArg = nullptr;
+    size_t sweepCursor = 0;
+
+    void grow();
+
+    void pushFree(void *slot);
+
+    void pushFreeSlots(Slab *slab);
+
+    template<typename Predicate>
+    void sweepSlab(Slab *slab, Predicate isDead);
+
+public:
+    SlabPool(size_t objectSize, void (*destroy)(void *));
+
+    ~SlabPool();
+
+    SlabPool(const SlabPool &) = delete;
+
+    SlabPool &operator=(const SlabPool &) = delete;
+
+    void *allocate();
+
+    // Destroys the object in `slot` and returns the slot to its pool.
+    static void release(void *slot);
+
+    // Walks every live slot and releases those for which `isDead` returns
+    // true. Slabs left empty are returned to the system.
+    template<typename Predicate>
+    void sweep(Predicate isDead);
+
+    // Starts a sweep that is carried out one slab at a time, whenever
+    // allocation runs out of free slots, instead of all at once. Objects
+    // allocated meanwhile come from already swept slabs, so `isDead` is
+    // only ever asked about objects that existed when the sweep began.
+    void sweepLazily(bool (*isDead)(void *slot, void *arg), void *arg);
+
+    // Sweeps the next pending slab, returning false if there was none.
+    bool sweepNext();
+
+    bool isSweeping() const { return lazyIsDead != nullptr; }
+
+    // Destroys every live object and frees all slabs.
+    void clear();
+
+    size_t getLiveCount() const { return liveCount; }
+
+    size_t getSlabCount() const { return slabs.size(); }
+
+    size_t getSlotSize() const { return slotSize; }
+};
+
+template<typename Predicate>
+void SlabPool::sweepSlab(Slab *slab, Predicate isDead) {
+    for (size_t word = 0; word * 64 < slab->slotCount; word++) {
+        uint64_t bits = slab->used[word];
+        while (bits) {
+            size_t bit = lowestSetBit(bits);
+            bits &= bits - 1;
+            void *slot = slab->slots + (word * 64 + bit) * slotSize;
+            if (isDead(slot)) {
+                if (destroy) {
+                    destroy(slot);
+                }
+                slab->used[word] &= ~((uint64_t) 1 << bit);
+                slab->liveCount--;
+                liveCount--;
+            }
+        }
+    }
+}
+
+template<typename Predicate>
+void SlabPool::sweep(Predicate isDead) {
+    lazyIsDead = nullptr;
+    freeList = nullptr;
+    vector<Slab *> kept;
+    for (auto *slab : slabs) {
+        sweepSlab(slab, isDead);
+        if (slab->liveCount == 0 && !kept.empty()) {
+            Slab::destroy(slab);
+            continue;
+        }
+        kept.push_back(slab);
+    }
+    slabs = kept;
+    // Rebuild the free list from high to low addresses so that allocation
+    // proceeds in address order within each slab.
+    for (auto it = slabs.rbegin(); it != slabs.rend(); ++it) {
+        pushFreeSlots(*it);
+    }
+}
+
+#endif
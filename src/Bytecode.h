@@ -0,0 +1,167 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Parser.h"
+#include "Value.h"
+
+using namespace std;
+
+// Instructions of the stack machine run by VM. Operands index the tables of
+// the Code they belong to unless noted otherwise.
+enum class Op : uint8_t {
+    LOAD_NONE,
+    LOAD_NUMBER,    // numbers[operand]
+    LOAD_FLOAT,     // floats[operand]
+    LOAD_STRING,    // strings[operand]
+    LOAD_CONSTANT,  // constants[operand], a literal made by the Optimizer
+    // Names outside function bodies, and names of the top level scope seen
+    // from inside one, are looked up by name. Locals of function bodies live
+    // in numbered slots of their frame, found by `depth` and slot number.
+    LOAD_NAME,      // names[operand]
+    LOAD_GLOBAL,    // names[operand], in the scope `depth` frames out
+    LOAD_LOCAL,     // slot operand
+    LOAD_OUTER,     // slot operand, `depth` frames out
+    STORE_NAME,     // names[operand]
+    STORE_LOCAL,    // slot operand
+    STORE_NONLOCAL, // names[operand], declared with 外側
+    DEFINE_NAME,    // names[operand], binds a function without following 外側
+    DEFINE_MEMBER,  // names[operand], binds a function into a dictionary
+    POP,
+    ADD, SUB, MUL, DIV, EQUAL, NEQ, GT, LT, GTE, LTE,
+    // Quickened forms the generic operators above rewrite themselves into
+    // for the operand types they see. The generic op is kept in `operand`
+    // and restored when the types change; an instruction restored that way
+    // is marked `deoptimized` and is not quickened again.
+    ADD_INT, SUB_INT, MUL_INT, DIV_INT, EQUAL_INT, NEQ_INT, GT_INT, LT_INT, GTE_INT, LTE_INT,
+    // Both operands numbers, at least one of them a float.
+    ADD_FLOAT, SUB_FLOAT, MUL_FLOAT, DIV_FLOAT, GT_FLOAT, LT_FLOAT, GTE_FLOAT, LTE_FLOAT,
+    CONCAT,
+    // Call chain steps. When a step fails, None is pushed and execution
+    // continues at `target`, the end of the chain.
+    CALL,           // callSites[operand]
+    GET,            // properties[operand]
+    GET_BIND,       // properties[operand]
+    SUBSCRIPT,
+    SET,            // names[operand]
+    SUBSCRIPT_SET,
+    JUMP,           // to `target`
+    JUMP_IF_FALSE,  // to `target`
+    JUMP_BACK,      // to `target`, the start of a loop; a collector safepoint
+    // Counts up a 繰り返す range: with the counter and the limit on top of
+    // the stack, pushes the counter and increments it in place, or pops both
+    // and jumps to `target` once the counter reaches the limit.
+    FOR_RANGE,
+    MAKE_FUNCTION,  // functions[operand]
+    IMPORT,         // imports[operand]
+    NONLOCAL,       // names[operand]
+    ASSERT,         // source line in operand
+    RETURN,         // signals a return of the top of the stack, see Completion
+    RESULT,         // returns the top of the stack as is
+    END             // returns None
+};
+const string OpStrings[] = {
+        "LOAD_NONE", "LOAD_NUMBER", "LOAD_FLOAT", "LOAD_STRING", "LOAD_CONSTANT",
+        "LOAD_NAME", "LOAD_GLOBAL", "LOAD_LOCAL", "LOAD_OUTER",
+        "STORE_NAME", "STORE_LOCAL", "STORE_NONLOCAL", "DEFINE_NAME", "DEFINE_MEMBER", "POP",
+        "ADD", "SUB", "MUL", "DIV", "EQUAL", "NEQ", "GT", "LT", "GTE", "LTE",
+        "ADD_INT", "SUB_INT", "MUL_INT", "DIV_INT", "EQUAL_INT", "NEQ_INT",
+        "GT_INT", "LT_INT", "GTE_INT", "LTE_INT",
+        "ADD_FLOAT", "SUB_FLOAT", "MUL_FLOAT", "DIV_FLOAT", "GT_FLOAT", "LT_FLOAT", "GTE_FLOAT", "LTE_FLOAT",
+        "CONCAT",
+        "CALL", "GET", "GET_BIND", "SUBSCRIPT", "SET", "SUBSCRIPT_SET",
+        "JUMP", "JUMP_IF_FALSE", "JUMP_BACK", "FOR_RANGE", "MAKE_FUNCTION", "IMPORT", "NONLOCAL", "ASSERT",
+        "RETURN", "RESULT", "END"
+};
+const size_t OpCount = sizeof(OpStrings) / sizeof(OpStrings[0]);
+
+struct Instruction {
+    Op op;
+    // Frames out from the current one, for LOAD_GLOBAL and LOAD_OUTER.
+    uint16_t depth;
+    // Set on an operator put back from its quickened form for good.
+    bool deoptimized;
+    uint32_t operand;
+    uint32_t target;
+};
+
+struct CallSite {
+    // Number of arguments on the stack above the function.
+    size_t argc;
+    // Keyword of each argument, empty for positional ones.
+    vector<Symbol> keywords;
+    bool hasKeywords;
+    // Tail calls are signalled to UserFunctionValue::apply rather than
+    // made in place when the callee is a user function.
+    TailPosition tail;
+};
+
+// A `・` or `〜` read, with the inline cache it fills as it runs.
+struct PropertySite {
+    uint32_t name;  // names[name]
+    PropertyCache cache;
+};
+
+class Code;
+
+// Everything needed to create a UserFunctionValue except its default values,
+// which are evaluated onto the stack before MAKE_FUNCTION.
+struct FunctionTemplate {
+    // Shown in disassembly only; binding the function is left to the
+    // instructions that follow MAKE_FUNCTION.
+    Symbol name;
+    vector<Symbol> params;
+    vector<Symbol> defaultParams;
+    bool hasVarParam;
+    Symbol varParam;
+    bool hasVarKeywordParam;
+    Symbol varKeywordParam;
+    SyntaxNode *bodyNode;
+    // Shared with the functions made from it, which outlive this Code when
+    // its syntax tree is deleted.
+    shared_ptr<Code> body;
+};
+
+// A compiled program or function body.
+class Code {
+public:
+    // Rewritten in place by quickening, hence mutable.
+    mutable vector<Instruction> instructions;
+    vector<long> numbers;
+    vector<double> floats;
+    vector<wstring> strings;
+    // Pinned by this Code until it is deleted, which may be long after the
+    // syntax tree they were made for.
+    vector<Value *> constants;
+    vector<Symbol> names;
+    vector<CallSite> callSites;
+    // Caches are updated while the code runs, hence mutable.
+    mutable vector<PropertySite> properties;
+    vector<FunctionTemplate> functions;
+    vector<vector<wstring>> imports;
+    // Frame layout of a function body: parameters first, then every other
+    // name the body binds. Empty for top level code.
+    vector<Symbol> slotNames;
+    unordered_map<Symbol, uint32_t> slotIndex;
+    vector<uint32_t> paramSlots;
+
+    Code() = default;
+
+    Code(const Code &) = delete;
+
+    Code &operator=(const Code &) = delete;
+
+    // Unpins the constants, so it must run before their Context is cleaned
+    // up.
+    ~Code();
+
+    // Disassembly, including nested function bodies.
+    string toString() const;
+};
+
+#endif
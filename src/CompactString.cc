@@ -0,0 +1,182 @@
+#include "CompactString.h"
+
+CompactString::CompactString(const wstring &str) : count(str.size()) {
+    if (count == 0) {
+        return;
+    }
+    for (wchar_t character : str) {
+        uint8_t needed = shiftFor((uint32_t) character);
+        if (needed > shift) {
+            shift = needed;
+        }
+    }
+    units = make_shared<string>(byteLength(), '\0');
+    for (size_t i = 0; i < count; i++) {
+        store(i, (uint32_t) str[i]);
+    }
+}
+
+void CompactString::store(size_t index, uint32_t character) {
+    string &buffer = *units;
+    if (shift == 0) {
+        buffer[index] = (char) character;
+    } else if (shift == 1) {
+        uint16_t unit = (uint16_t) character;
+        memcpy(&buffer[index * 2], &unit, sizeof(unit));
+    } else {
+        memcpy(&buffer[index * 4], &character, sizeof(character));
+    }
+}
+
+void CompactString::appendInPlace(const CompactString &rhs) {
+    if (rhs.shift == shift) {
+        // Also right when rhs shares the buffer, as in 結果＋結果.
+        units->append(*rhs.units, 0, rhs.byteLength());
+    } else {
+        units->resize(byteLength() + (rhs.count << shift));
+        for (size_t i = 0; i < rhs.count; i++) {
+            store(count + i, (uint32_t) rhs[i]);
+        }
+    }
+    count += rhs.count;
+}
+
+CompactString CompactString::substr(size_t start, size_t length) const {
+    if (start >= count) {
+        return CompactString();
+    }
+    if (length > count - start) {
+        length = count - start;
+    }
+    // The slice may fit a narrower width than the whole.
+    uint8_t needed = 0;
+    for (size_t i = start; i < start + length && needed < shift; i++) {
+        uint8_t characterShift = shiftFor((uint32_t) (*this)[i]);
+        if (characterShift > needed) {
+            needed = characterShift;
+        }
+    }
+    CompactString result;
+    if (length == 0) {
+        return result;
+    }
+    result.count = length;
+    result.shift = needed;
+    if (needed == shift) {
+        result.units = make_shared<string>(data() + (start << shift), length << shift);
+        return result;
+    }
+    result.units = make_shared<string>(length << needed, '\0');
+    for (size_t i = 0; i < length; i++) {
+        result.store(i, (uint32_t) (*this)[start + i]);
+    }
+    return result;
+}
+
+wstring CompactString::toWString() const {
+    wstring result(count, L'\0');
+    for (size_t i = 0; i < count; i++) {
+        result[i] = (*this)[i];
+    }
+    return result;
+}
+
+string CompactString::toUTF8() const {
+    if (shift == 0) {
+        const char *bytes = data();
+        size_t ascii = 0;
+        while (ascii < count && (unsigned char) bytes[ascii] < 0x80) {
+            ascii++;
+        }
+        if (ascii == count) {
+            return string(bytes, count);
+        }
+    }
+    string result;
+    result.reserve(byteLength());
+    for (size_t i = 0; i < count; i++) {
+        uint32_t character = (uint32_t) (*this)[i];
+        // A UTF-16 wchar_t keeps characters past the BMP as surrogate pairs.
+        if (character >= 0xD800 && character <= 0xDBFF && i + 1 < count) {
+            uint32_t low = (uint32_t) (*this)[i + 1];
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                character = 0x10000 + ((character - 0xD800) << 10) + (low - 0xDC00);
+                i++;
+            }
+        }
+        if (character < 0x80) {
+            result.push_back((char) character);
+        } else if (character < 0x800) {
+            result.push_back((char) (0xC0 | (character >> 6)));
+            result.push_back((char) (0x80 | (character & 0x3F)));
+        } else if (character < 0x10000) {
+            result.push_back((char) (0xE0 | (character >> 12)));
+            result.push_back((char) (0x80 | ((character >> 6) & 0x3F)));
+            result.push_back((char) (0x80 | (character & 0x3F)));
+        } else {
+            result.push_back((char) (0xF0 | (character >> 18)));
+            result.push_back((char) (0x80 | ((character >> 12) & 0x3F)));
+            result.push_back((char) (0x80 | ((character >> 6) & 0x3F)));
+            result.push_back((char) (0x80 | (character & 0x3F)));
+        }
+    }
+    return result;
+}
+
+size_t CompactString::hash() const {
+    if (!hashed) {
+        // FNV-1a over this string's part of the buffer.
+        size_t result = 14695981039346656037ULL;
+        const char *bytes = data();
+        for (size_t i = 0; i < byteLength(); i++) {
+            result = (result ^ (unsigned char) bytes[i]) * 1099511628211ULL;
+        }
+        hashValue = result;
+        hashed = true;
+    }
+    return hashValue;
+}
+
+CompactString CompactString::operator+(const CompactString &rhs) const {
+    if (rhs.empty()) {
+        return *this;
+    } else if (empty()) {
+        return rhs;
+    }
+    CompactString result;
+    if (rhs.shift <= shift && units->size() == byteLength()) {
+        // Nothing was appended after this string yet, so the buffer can
+        // grow under it.
+        result.units = units;
+        result.shift = shift;
+        result.count = count;
+    } else {
+        result.shift = shift > rhs.shift ? shift : rhs.shift;
+        result.count = count;
+        result.units = make_shared<string>();
+        result.units->reserve((count + rhs.count) << result.shift);
+        if (result.shift == shift) {
+            result.units->assign(data(), byteLength());
+        } else {
+            result.units->resize(count << result.shift);
+            for (size_t i = 0; i < count; i++) {
+                result.store(i, (uint32_t) (*this)[i]);
+            }
+        }
+    }
+    result.appendInPlace(rhs);
+    return result;
+}
+
+bool CompactString::operator==(const CompactString &rhs) const {
+    if (count != rhs.count || shift != rhs.shift) {
+        return false;
+    }
+    if (units == rhs.units) {
+        return true;
+    }
+    if (hashed && rhs.hashed && hashValue != rhs.hashValue) {
+        return false;
+    }
+    return memcmp(data(), rhs.data(), byteLength()) == 0;
+}
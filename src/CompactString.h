@@ -0,0 +1,110 @@
+#ifndef COMPACT_STRING_H
+#define COMPACT_STRING_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+
+using namespace std;
+
+// Immutable text stored with the narrowest code unit that holds every
+// character: one byte when all of it is Latin-1, two for the rest of the
+// BMP (most Japanese text), four only past it. The width is always the
+// narrowest possible, so two strings of different widths are never equal.
+// The length is kept and the hash is computed once, on first use.
+//
+// Strings made by concatenation share an append-only buffer with their left
+// operand: each string sees the first `count` units of it, and a string that
+// ends where the buffer ends appends in place instead of copying. Building a
+// string a piece at a time, as in 結果＝結果＋文字, is then linear overall.
+class CompactString {
+    // Code units, 1 << shift bytes each, in native byte order. Null when
+    // empty; only ever appended to, so every sharer's prefix stays intact.
+    shared_ptr<string> units;
+    uint8_t shift = 0;
+    size_t count = 0;
+    mutable size_t hashValue = 0;
+    mutable bool hashed = false;
+
+    const char *data() const { return units ? units->data() : ""; }
+
+    size_t byteLength() const { return count << shift; }
+
+    static uint8_t shiftFor(uint32_t character) {
+        return character <= 0xFF ? 0 : character <= 0xFFFF ? 1 : 2;
+    }
+
+    // `units` must be sized for `index` units or more of this width.
+    void store(size_t index, uint32_t character);
+
+    // Appends `rhs`, which is no wider, at the end of the shared buffer.
+    void appendInPlace(const CompactString &rhs);
+
+public:
+    CompactString() = default;
+
+    CompactString(const wstring &str);
+
+    size_t length() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    // Bytes per character.
+    size_t width() const { return (size_t) 1 << shift; }
+
+    wchar_t operator[](size_t index) const {
+        if (shift == 0) {
+            return (wchar_t) (unsigned char) data()[index];
+        } else if (shift == 1) {
+            uint16_t unit;
+            memcpy(&unit, data() + index * 2, sizeof(unit));
+            return (wchar_t) unit;
+        }
+        uint32_t unit;
+        memcpy(&unit, data() + index * 4, sizeof(unit));
+        return (wchar_t) unit;
+    }
+
+    CompactString substr(size_t start, size_t length) const;
+
+    wstring toWString() const;
+
+    // Encoded straight from the code units, without a wstring in between.
+    string toUTF8() const;
+
+    size_t hash() const;
+
+    // This string's share of the buffer, so that the strings sharing one
+    // add up to its size.
+    size_t memorySize() const { return units ? units->capacity() / units.use_count() : 0; }
+
+    CompactString operator+(const CompactString &rhs) const;
+
+    bool operator==(const CompactString &rhs) const;
+
+    bool operator!=(const CompactString &rhs) const { return !(*this == rhs); }
+};
+
+inline bool operator==(const CompactString &lhs, const wstring &rhs) {
+    return lhs == CompactString(rhs);
+}
+
+inline bool operator==(const wchar_t *lhs, const CompactString &rhs) {
+    return CompactString(lhs) == rhs;
+}
+
+inline ostream &operator<<(ostream &out, const CompactString &str) {
+    return out << str.toUTF8();
+}
+
+namespace std {
+    template<>
+    struct hash<CompactString> {
+        size_t operator()(const CompactString &str) const { return str.hash(); }
+    };
+}
+
+#endif
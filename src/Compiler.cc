@@ -0,0 +1,530 @@
+#include <iomanip>
+#include "Compiler.h"
+
+Code *Compiler::compile(SyntaxNode *tree) {
+    auto result = new Code();
+    code = result;
+    switch (tree->type) {
+        case NodeType::TEXT:
+            compileStatements(tree, TailPosition::NONE);
+            emit(Op::END);
+            break;
+        case NodeType::CALL:
+            compileCall(tree, TailPosition::NONE);
+            emit(Op::RESULT);
+            break;
+        case NodeType::FUNC:
+        case NodeType::RETURN:
+        case NodeType::IMPORT:
+        case NodeType::EXTERNAL:
+        case NodeType::IF:
+        case NodeType::LOOP:
+        case NodeType::RANGE_LOOP:
+        case NodeType::ASSIGN:
+        case NodeType::ASSERT:
+            compileStatement(tree, TailPosition::NONE);
+            emit(Op::END);
+            break;
+        default:
+            compileExpression(tree);
+            emit(Op::RESULT);
+    }
+    return result;
+}
+
+size_t Compiler::emit(Op op, uint32_t operand, uint16_t depth) {
+    code->instructions.push_back({op, depth, false, operand, 0});
+    return code->instructions.size() - 1;
+}
+
+void Compiler::patch(size_t instruction) {
+    code->instructions[instruction].target = (uint32_t) code->instructions.size();
+}
+
+uint32_t Compiler::nameIndex(Symbol name) {
+    for (size_t i = 0; i < code->names.size(); i++) {
+        if (code->names[i] == name) {
+            return (uint32_t) i;
+        }
+    }
+    code->names.push_back(name);
+    return (uint32_t) code->names.size() - 1;
+}
+
+// Every access site gets its own cache, so sites are never shared.
+uint32_t Compiler::propertyIndex(Symbol name) {
+    code->properties.push_back({nameIndex(name), PropertyCache()});
+    return (uint32_t) code->properties.size() - 1;
+}
+
+void Compiler::declareSlot(Symbol name) {
+    if (code->slotIndex.count(name) == 0) {
+        code->slotIndex[name] = (uint32_t) code->slotNames.size();
+        code->slotNames.push_back(name);
+    }
+}
+
+// Collects the names a function body binds, without descending into the
+// bodies of nested functions. 外側 applies to the whole body wherever it
+// appears.
+void Compiler::declareLocals(SyntaxNode *node, vector<Symbol> &assigned, vector<Symbol> &functions,
+                             unordered_set<Symbol> &nonlocals) {
+    switch (node->type) {
+        case NodeType::RANGE_LOOP:
+            assigned.push_back(node->children[0]->content.symbol);
+            // fallthrough
+        case NodeType::TEXT:
+        case NodeType::IF:
+        case NodeType::LOOP:
+            for (auto child : node->children) {
+                declareLocals(child, assigned, functions, nonlocals);
+            }
+            break;
+        case NodeType::ASSIGN:
+            assigned.push_back(node->children[0]->content.symbol);
+            break;
+        case NodeType::FUNC:
+            if (node->children[0]->type == NodeType::TERMINAL) {
+                functions.push_back(node->children[0]->content.symbol);
+            }
+            break;
+        case NodeType::EXTERNAL:
+            for (auto child : node->children) {
+                nonlocals.insert(child->content.symbol);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void Compiler::compileLoad(Symbol name) {
+    for (size_t depth = 0; depth < scopes.size(); depth++) {
+        Code *scope = scopes[scopes.size() - 1 - depth].code;
+        auto slot = scope->slotIndex.find(name);
+        if (slot != scope->slotIndex.end()) {
+            emit(depth == 0 ? Op::LOAD_LOCAL : Op::LOAD_OUTER, slot->second, (uint16_t) depth);
+            return;
+        }
+    }
+    if (scopes.empty()) {
+        emit(Op::LOAD_NAME, nameIndex(name));
+    } else {
+        emit(Op::LOAD_GLOBAL, nameIndex(name), (uint16_t) scopes.size());
+    }
+}
+
+void Compiler::compileStore(Symbol name) {
+    if (scopes.empty()) {
+        emit(Op::STORE_NAME, nameIndex(name));
+    } else if (scopes.back().nonlocals.count(name)) {
+        emit(Op::STORE_NONLOCAL, nameIndex(name));
+    } else {
+        emit(Op::STORE_LOCAL, code->slotIndex.at(name));
+    }
+}
+
+void Compiler::compileStatements(SyntaxNode *node, TailPosition position) {
+    for (size_t i = 0; i < node->children.size(); i++) {
+        bool last = i == node->children.size() - 1;
+        compileStatement(node->children[i],
+                         position == TailPosition::LAST && !last ? TailPosition::BODY : position);
+    }
+}
+
+void Compiler::compileStatement(SyntaxNode *node, TailPosition position) {
+    switch (node->type) {
+        case NodeType::CALL:
+            compileCall(node, position);
+            emit(Op::POP);
+            break;
+        case NodeType::TEXT:
+            compileStatements(node, position);
+            break;
+        case NodeType::FUNC:
+            compileFunction(node);
+            break;
+        case NodeType::RETURN:
+            if (node->children[0]->type == NodeType::CALL) {
+                compileCall(node->children[0],
+                            position == TailPosition::NONE ? TailPosition::NONE : TailPosition::RETURNED);
+            } else {
+                compileExpression(node->children[0]);
+            }
+            emit(Op::RETURN);
+            break;
+        case NodeType::IMPORT: {
+            vector<wstring> path;
+            for (auto child : node->children) {
+                path.push_back(child->content.content);
+            }
+            code->imports.push_back(path);
+            emit(Op::IMPORT, (uint32_t) code->imports.size() - 1);
+            break;
+        }
+        case NodeType::EXTERNAL:
+            // Resolved statically inside function bodies.
+            if (scopes.empty()) {
+                for (auto child : node->children) {
+                    emit(Op::NONLOCAL, nameIndex(child->content.symbol));
+                }
+            }
+            break;
+        case NodeType::IF:
+            compileIf(node, position);
+            break;
+        case NodeType::LOOP:
+        case NodeType::RANGE_LOOP:
+            compileLoop(node, position);
+            break;
+        case NodeType::ASSIGN:
+            compileExpression(node->children[1]);
+            compileStore(node->children[0]->content.symbol);
+            break;
+        case NodeType::ASSERT:
+            compileExpression(node->children[0]);
+            emit(Op::ASSERT, (uint32_t) node->content.line);
+            break;
+        default:
+            compileExpression(node);
+            emit(Op::POP);
+    }
+}
+
+void Compiler::compileExpression(SyntaxNode *node) {
+    switch (node->type) {
+        case NodeType::TERMINAL:
+            compileTerminal(node);
+            return;
+        case NodeType::CALL:
+            compileCall(node, TailPosition::NONE);
+            return;
+        case NodeType::ADD:
+        case NodeType::SUB:
+        case NodeType::MUL:
+        case NodeType::DIV:
+        case NodeType::EQUAL:
+        case NodeType::NEQ:
+        case NodeType::GT:
+        case NodeType::LT:
+        case NodeType::GTE:
+        case NodeType::LTE:
+            break;
+        default:
+            emit(Op::LOAD_NONE);
+            return;
+    }
+    compileExpression(node->children[0]);
+    compileExpression(node->children[1]);
+    switch (node->type) {
+        case NodeType::ADD:
+            emit(Op::ADD);
+            break;
+        case NodeType::SUB:
+            emit(Op::SUB);
+            break;
+        case NodeType::MUL:
+            emit(Op::MUL);
+            break;
+        case NodeType::DIV:
+            emit(Op::DIV);
+            break;
+        case NodeType::EQUAL:
+            emit(Op::EQUAL);
+            break;
+        case NodeType::NEQ:
+            emit(Op::NEQ);
+            break;
+        case NodeType::GT:
+            emit(Op::GT);
+            break;
+        case NodeType::LT:
+            emit(Op::LT);
+            break;
+        case NodeType::GTE:
+            emit(Op::GTE);
+            break;
+        default:
+            emit(Op::LTE);
+    }
+}
+
+void Compiler::compileTerminal(SyntaxNode *node) {
+    const Token &token = node->content;
+    if (node->constant) {
+        node->constant->refs++;
+        code->constants.push_back(node->constant);
+        emit(Op::LOAD_CONSTANT, (uint32_t) code->constants.size() - 1);
+    } else if (token.type == TokenType::SYMBOL) {
+        compileLoad(token.symbol);
+    } else if (token.type == TokenType::NUMBER) {
+        code->numbers.push_back(token.number);
+        emit(Op::LOAD_NUMBER, (uint32_t) code->numbers.size() - 1);
+    } else if (token.type == TokenType::NUMBER_FLOAT) {
+        code->floats.push_back(token.numberFloat);
+        emit(Op::LOAD_FLOAT, (uint32_t) code->floats.size() - 1);
+    } else if (token.type == TokenType::STRING) {
+        code->strings.push_back(token.content);
+        emit(Op::LOAD_STRING, (uint32_t) code->strings.size() - 1);
+    } else {
+        emit(Op::LOAD_NONE);
+    }
+}
+
+void Compiler::compileCall(SyntaxNode *node, TailPosition position) {
+    compileExpression(node->children[0]);
+    vector<size_t> exits;
+    compileTail(node->children[1], position, exits);
+    for (auto exit : exits) {
+        patch(exit);
+    }
+}
+
+// Compiles one step of a call chain and the steps after it. Steps that can
+// fail are collected in `exits` and later pointed past the whole chain.
+void Compiler::compileTail(SyntaxNode *tail, TailPosition position, vector<size_t> &exits) {
+    bool hasNext = tail->children.size() == 2;
+    switch (tail->type) {
+        case NodeType::CALL_TAIL: {
+            CallSite site{0, {}, false, hasNext ? TailPosition::NONE : position};
+            for (auto argument : tail->children[0]->children) {
+                if (argument->type == NodeType::KWARG) {
+                    compileExpression(argument->children[1]);
+                    site.keywords.push_back(argument->children[0]->content.symbol);
+                    site.hasKeywords = true;
+                } else {
+                    compileExpression(argument);
+                    site.keywords.emplace_back();
+                }
+                site.argc++;
+            }
+            code->callSites.push_back(site);
+            exits.push_back(emit(Op::CALL, (uint32_t) code->callSites.size() - 1));
+            break;
+        }
+        case NodeType::GET:
+            exits.push_back(emit(Op::GET, propertyIndex(tail->children[0]->content.symbol)));
+            break;
+        case NodeType::GET_BIND:
+            exits.push_back(emit(Op::GET_BIND, propertyIndex(tail->children[0]->content.symbol)));
+            break;
+        case NodeType::SUBSCRIPT:
+            compileExpression(tail->children[0]);
+            exits.push_back(emit(Op::SUBSCRIPT));
+            break;
+        case NodeType::SET:
+            compileExpression(tail->children[1]);
+            emit(Op::SET, nameIndex(tail->children[0]->content.symbol));
+            return;
+        case NodeType::SUBSCRIPT_SET:
+            compileExpression(tail->children[0]);
+            compileExpression(tail->children[1]);
+            emit(Op::SUBSCRIPT_SET);
+            return;
+        default:
+            emit(Op::POP);
+            emit(Op::LOAD_NONE);
+            return;
+    }
+    if (hasNext) {
+        compileTail(tail->children[1], position, exits);
+    }
+}
+
+void Compiler::compileIf(SyntaxNode *node, TailPosition position) {
+    vector<size_t> ends;
+    for (size_t i = 0; i < node->children.size(); i += 2) {
+        if (i == node->children.size() - 1) {
+            compileStatement(node->children[i], position);
+            break;
+        }
+        compileExpression(node->children[i]);
+        auto skip = emit(Op::JUMP_IF_FALSE);
+        compileStatement(node->children[i + 1], position);
+        ends.push_back(emit(Op::JUMP));
+        patch(skip);
+    }
+    for (auto end : ends) {
+        patch(end);
+    }
+}
+
+// The body is never in tail position, as in Environment::eval_loop.
+void Compiler::compileLoop(SyntaxNode *node, TailPosition position) {
+    TailPosition bodyPosition = position == TailPosition::NONE ? TailPosition::NONE : TailPosition::BODY;
+    size_t start;
+    size_t exit;
+    if (node->type == NodeType::LOOP) {
+        start = code->instructions.size();
+        compileExpression(node->children[0]);
+        exit = emit(Op::JUMP_IF_FALSE);
+    } else {
+        compileExpression(node->children[1]);
+        compileExpression(node->children[2]);
+        start = exit = emit(Op::FOR_RANGE);
+        compileStore(node->children[0]->content.symbol);
+    }
+    compileStatement(node->children.back(), bodyPosition);
+    code->instructions[emit(Op::JUMP_BACK)].target = (uint32_t) start;
+    patch(exit);
+}
+
+void Compiler::compileFunction(SyntaxNode *node) {
+    FunctionTemplate function{};
+    auto nameNode = node->children[0];
+    if (nameNode->type == NodeType::TERMINAL) {
+        function.name = nameNode->content.symbol;
+    } else {
+        function.name = nameNode->children[1]->content.symbol;
+    }
+    for (auto param : node->children[1]->children) {
+        if (param->type == NodeType::TERMINAL) {
+            function.params.push_back(param->content.symbol);
+        } else if (param->type == NodeType::VARKWPARAM) {
+            function.hasVarKeywordParam = true;
+            function.varKeywordParam = param->children[0]->content.symbol;
+        } else if (param->type == NodeType::VARPARAM) {
+            function.hasVarParam = true;
+            function.varParam = param->children[0]->content.symbol;
+        } else if (param->type == NodeType::DEFAULTPARAM) {
+            compileExpression(param->children[1]);
+            function.defaultParams.push_back(param->children[0]->content.symbol);
+        }
+    }
+    function.bodyNode = node->children[2];
+    function.body = shared_ptr<Code>(compileBody(function, node->children[2]));
+    code->functions.push_back(std::move(function));
+    emit(Op::MAKE_FUNCTION, (uint32_t) code->functions.size() - 1);
+    if (nameNode->type == NodeType::TERMINAL) {
+        if (scopes.empty()) {
+            emit(Op::DEFINE_NAME, nameIndex(nameNode->content.symbol));
+        } else {
+            emit(Op::STORE_LOCAL, code->slotIndex.at(nameNode->content.symbol));
+        }
+    } else {
+        compileLoad(nameNode->children[0]->content.symbol);
+        emit(Op::DEFINE_MEMBER, nameIndex(nameNode->children[1]->content.symbol));
+    }
+}
+
+Code *Compiler::compileBody(const FunctionTemplate &function, SyntaxNode *body) {
+    Code *outer = code;
+    code = new Code();
+    for (auto &param : function.params) {
+        declareSlot(param);
+        code->paramSlots.push_back(code->slotIndex[param]);
+    }
+    for (auto &param : function.defaultParams) {
+        declareSlot(param);
+    }
+    if (function.hasVarParam) {
+        declareSlot(function.varParam);
+    }
+    if (function.hasVarKeywordParam) {
+        declareSlot(function.varKeywordParam);
+    }
+    Scope scope{code, {}};
+    vector<Symbol> assigned;
+    vector<Symbol> functions;
+    declareLocals(body, assigned, functions, scope.nonlocals);
+    for (auto &name : assigned) {
+        if (scope.nonlocals.count(name) == 0) {
+            declareSlot(name);
+        }
+    }
+    for (auto &name : functions) {
+        declareSlot(name);
+    }
+
+    scopes.push_back(scope);
+    compileStatements(body, TailPosition::LAST);
+    emit(Op::END);
+    scopes.pop_back();
+    Code *result = code;
+    code = outer;
+    return result;
+}
+
+Code::~Code() {
+    for (auto constant : constants) {
+        constant->refs--;
+    }
+}
+
+string Code::toString() const {
+    ostringstream result;
+    for (size_t i = 0; i < instructions.size(); i++) {
+        auto &instruction = instructions[i];
+        result << setw(4) << setfill('0') << i << " " << OpStrings[(size_t) instruction.op];
+        switch (instruction.op) {
+            case Op::LOAD_NUMBER:
+                result << " " << numbers[instruction.operand];
+                break;
+            case Op::LOAD_FLOAT:
+                result << " " << floats[instruction.operand];
+                break;
+            case Op::LOAD_STRING:
+                result << " 「" << encodeUTF8(strings[instruction.operand]) << "」";
+                break;
+            case Op::LOAD_CONSTANT:
+                result << " " << constants[instruction.operand]->toStringJP();
+                break;
+            case Op::LOAD_LOCAL:
+            case Op::STORE_LOCAL:
+                result << " " << encodeUTF8(slotNames[instruction.operand].name());
+                break;
+            case Op::LOAD_OUTER:
+                result << " " << instruction.depth << ":" << instruction.operand;
+                break;
+            case Op::LOAD_GLOBAL:
+                result << " " << instruction.depth << ":" << encodeUTF8(names[instruction.operand].name());
+                break;
+            case Op::LOAD_NAME:
+            case Op::STORE_NAME:
+            case Op::STORE_NONLOCAL:
+            case Op::DEFINE_NAME:
+            case Op::DEFINE_MEMBER:
+            case Op::SET:
+            case Op::NONLOCAL:
+                result << " " << encodeUTF8(names[instruction.operand].name());
+                break;
+            case Op::GET:
+            case Op::GET_BIND:
+                result << " " << encodeUTF8(names[properties[instruction.operand].name].name());
+                break;
+            case Op::CALL:
+                result << " " << callSites[instruction.operand].argc
+                       << (callSites[instruction.operand].tail == TailPosition::RETURNED ? " tail" :
+                           callSites[instruction.operand].tail == TailPosition::LAST ? " tail-drop" : "");
+                break;
+            case Op::MAKE_FUNCTION:
+                result << " " << encodeUTF8(functions[instruction.operand].name.name());
+                break;
+            case Op::ASSERT:
+                result << " line " << instruction.operand;
+                break;
+            default:
+                break;
+        }
+        switch (instruction.op) {
+            case Op::CALL:
+            case Op::GET:
+            case Op::GET_BIND:
+            case Op::SUBSCRIPT:
+            case Op::JUMP:
+            case Op::JUMP_IF_FALSE:
+            case Op::JUMP_BACK:
+            case Op::FOR_RANGE:
+                result << " -> " << setw(4) << setfill('0') << instruction.target;
+                break;
+            default:
+                break;
+        }
+        result << endl;
+    }
+    for (auto &function : functions) {
+        result << endl << "関数 " << encodeUTF8(function.name.name()) << ":" << endl
+               << function.body->toString();
+    }
+    return result.str();
+}
@@ -0,0 +1,69 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <unordered_set>
+#include "Bytecode.h"
+#include "Parser.h"
+
+// Translates syntax trees into Code for the VM. The generated code mirrors
+// Environment::eval node for node, so both engines give the same results.
+//
+// Inside function bodies, names are resolved at compile time: every name a
+// body binds gets a slot in its frame, and references to it from the body or
+// from nested functions become slot accesses at a fixed depth. A slot that
+// has not been bound yet falls back to looking the name up in the enclosing
+// scopes, as a missing binding does in the tree walker.
+class Compiler {
+    struct Scope {
+        Code *code;
+        unordered_set<Symbol> nonlocals;
+    };
+
+    Code *code = nullptr;
+    // Function bodies being compiled, innermost last.
+    vector<Scope> scopes;
+
+    size_t emit(Op op, uint32_t operand = 0, uint16_t depth = 0);
+
+    void patch(size_t instruction);
+
+    uint32_t nameIndex(Symbol name);
+
+    uint32_t propertyIndex(Symbol name);
+
+    void declareSlot(Symbol name);
+
+    void declareLocals(SyntaxNode *node, vector<Symbol> &assigned, vector<Symbol> &functions,
+                       unordered_set<Symbol> &nonlocals);
+
+    void compileLoad(Symbol name);
+
+    void compileStore(Symbol name);
+
+    void compileStatements(SyntaxNode *node, TailPosition position);
+
+    void compileStatement(SyntaxNode *node, TailPosition position);
+
+    void compileExpression(SyntaxNode *node);
+
+    void compileTerminal(SyntaxNode *node);
+
+    void compileCall(SyntaxNode *node, TailPosition position);
+
+    void compileTail(SyntaxNode *tail, TailPosition position, vector<size_t> &exits);
+
+    void compileIf(SyntaxNode *node, TailPosition position);
+
+    void compileLoop(SyntaxNode *node, TailPosition position);
+
+    void compileFunction(SyntaxNode *node);
+
+    Code *compileBody(const FunctionTemplate &function, SyntaxNode *body);
+
+public:
+    // A program (TEXT) runs to END; a single statement returns what eval
+    // would, and a lone expression returns its value.
+    Code *compile(SyntaxNode *tree);
+};
+
+#endif
@@ -1,205 +1,796 @@
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <thread>
 #include <utility>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 
 #include "Context.h"
+#include "Compiler.h"
 
+#if defined(__GNUC__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address)
+#endif
 
+static void destroyValue(void *slot) {
+    ((Value *) slot)->~Value();
+}
+
+static void destroyEnvironment(void *slot) {
+    ((Environment *) slot)->~Environment();
+}
+
+
+// Sets `mark` to the current epoch, returning false if it already was.
+// Parallel markers can reach the same object at once, so the update is an
+// atomic exchange while they run.
+bool Context::claim(uint32_t &mark) {
+    if (!parallelMarking) {
+        if (mark == markEpoch) {
+            return false;
+        }
+        mark = markEpoch;
+        return true;
+    }
+#ifdef _MSC_VER
+    return (uint32_t) _InterlockedExchange((volatile long *) &mark, (long) markEpoch) != markEpoch;
+#else
+    return __atomic_exchange_n(&mark, markEpoch, __ATOMIC_RELAXED) != markEpoch;
+#endif
+}
+
+// Marking pushes onto an explicit stack instead of recursing, so that long
+// chains (linked lists, deep closure and caller chains) cannot overflow the
+// C++ stack. Children are pushed unchecked and prefetched; their mark is
+// tested when they are popped, by which time the header is usually cached.
 void Context::mark(Value *value) {
-    if (!usedValues.count(value)) {
-        usedValues.insert(value);
-        if (value->type == ValueType::FUNC &&
-            ((FunctionValue *) value)->functionType == FunctionValueType::USER_FUNCTION) {
-            auto f = (UserFunctionValue *) value;
-            mark(f->parentEnv);
-            auto defaults = f->getParamsWithDefault();
-            for (const auto &defaultItem : defaults) {
-                mark(defaultItem.second);
+    push(mainWorker, value);
+}
+
+void Context::mark(Environment *current_env) {
+    push(mainWorker, current_env);
+}
+
+void Context::push(MarkWorker &worker, Value *value) {
+    PREFETCH(value);
+    worker.values.push_back(value);
+}
+
+void Context::push(MarkWorker &worker, Environment *environment) {
+    PREFETCH(environment);
+    worker.environments.push_back(environment);
+}
+
+void Context::markChildren(MarkWorker &worker, Value *value) {
+    if (value->type == ValueType::FUNC &&
+        ((FunctionValue *) value)->functionType == FunctionValueType::USER_FUNCTION) {
+        auto f = (UserFunctionValue *) value;
+        push(worker, f->parentEnv);
+        const auto &defaults = f->getParamsWithDefault();
+        for (const auto &defaultItem : defaults) {
+            push(worker, defaultItem.second);
+        }
+    }
+    if (value->type == ValueType::FUNC &&
+        ((FunctionValue *) value)->functionType == FunctionValueType::BOUND_FUNCTION) {
+        auto f = dynamic_cast<BoundFunctionValue *> (value);
+        push(worker, f->function);
+        push(worker, f->jibun);
+    }
+    if (value->type == ValueType::DICT) {
+        auto d = static_cast<DictionaryValue *>(value);
+        d->forEachValue([&](Value *item) {
+            push(worker, item);
+        });
+        if (d->parent) {
+            push(worker, d->parent);
+        }
+    }
+    if (value->type == ValueType::ARRAY) {
+        auto array = (ArrayValue *) value;
+        for (const auto &item : array->value) {
+            if (item.isPointer()) {
+                push(worker, item.asPointer());
             }
         }
-        if (value->type == ValueType::FUNC &&
-            ((FunctionValue *) value)->functionType == FunctionValueType::BOUND_FUNCTION) {
-            auto f = dynamic_cast<BoundFunctionValue *> (value);
-            mark(f->function);
-            mark(f->jibun);
+        if (array->parent) {
+            push(worker, array->parent);
         }
-        if ((value->type == ValueType::DICT) || (value->type == ValueType::ARRAY)) {
-            auto d = static_cast<DictionaryValue *>(value);
-            for (const auto &item : d->value) {
-                mark(item.second);
+    }
+}
+
+void Context::markChildren(MarkWorker &worker, Environment *env) {
+    if (env->parent) {
+        push(worker, env->parent);
+    }
+    if (env->caller) {
+        push(worker, env->caller);
+    }
+    for (const auto &binding : env->bindings) {
+        if (binding.second->type != ValueType::NONE) {
+            push(worker, binding.second);
+        }
+    }
+    for (auto value : env->slots) {
+        if (value.isPointer() && !value.isNull() && value.asPointer()->type != ValueType::NONE) {
+            push(worker, value.asPointer());
+        }
+    }
+}
+
+// Pops and scans objects until the worker's own stacks are empty. While
+// other workers are idle, half of the pending work is offered to them.
+void Context::drain(MarkWorker &worker) {
+    for (;;) {
+        if (parallelMarking && idleWorkers.load(memory_order_relaxed) > 0 &&
+            !worker.hasShared.load(memory_order_relaxed) &&
+            (worker.values.size() > 1 || worker.environments.size() > 1)) {
+            share(worker);
+        }
+        if (!worker.values.empty()) {
+            auto value = worker.values.back();
+            worker.values.pop_back();
+            if ((minorCollection && !value->young) || !claim(value->mark)) {
+                continue;
+            }
+            worker.markedBytes += value->memorySize();
+            worker.markedValues[(size_t) value->type]++;
+            if (!value->managed) {
+                worker.foreignValues.push_back(value);
             }
-            if (d->parent) {
-                mark(d->parent);
+            markChildren(worker, value);
+        } else if (!worker.environments.empty()) {
+            auto environment = worker.environments.back();
+            worker.environments.pop_back();
+            if ((minorCollection && !environment->young) || !claim(environment->mark)) {
+                continue;
             }
+            worker.markedBytes += environment->memorySize();
+            worker.markedEnvironments++;
+            if (!environment->managed) {
+                worker.foreignEnvironments.push_back(environment);
+            }
+            markChildren(worker, environment);
+        } else {
+            break;
         }
-        if (value->type == ValueType::ARRAY) {
-            auto array = (ArrayValue *) value;
-            for (const auto &item : array->value) {
-                mark(item);
+    }
+}
+
+// Moves the oldest half of each stack, which is closest to the roots and so
+// likely to lead to the most work, to where other workers can steal it.
+void Context::share(MarkWorker &worker) {
+    lock_guard<mutex> guard(worker.lock);
+    auto valueCount = worker.values.size() / 2;
+    worker.sharedValues.insert(worker.sharedValues.end(),
+                               worker.values.begin(), worker.values.begin() + valueCount);
+    worker.values.erase(worker.values.begin(), worker.values.begin() + valueCount);
+    auto environmentCount = worker.environments.size() / 2;
+    worker.sharedEnvironments.insert(worker.sharedEnvironments.end(),
+                                     worker.environments.begin(),
+                                     worker.environments.begin() + environmentCount);
+    worker.environments.erase(worker.environments.begin(),
+                              worker.environments.begin() + environmentCount);
+    worker.hasShared.store(!worker.sharedValues.empty() || !worker.sharedEnvironments.empty());
+}
+
+// Moves everything `victim` has on offer to the thief's private stacks.
+bool Context::takeShared(MarkWorker &thief, MarkWorker &victim) {
+    if (!victim.hasShared.load()) {
+        return false;
+    }
+    lock_guard<mutex> guard(victim.lock);
+    if (!victim.hasShared.load()) {
+        return false;
+    }
+    thief.values.insert(thief.values.end(),
+                        victim.sharedValues.begin(), victim.sharedValues.end());
+    thief.environments.insert(thief.environments.end(),
+                              victim.sharedEnvironments.begin(), victim.sharedEnvironments.end());
+    victim.sharedValues.clear();
+    victim.sharedEnvironments.clear();
+    victim.hasShared.store(false);
+    return true;
+}
+
+// Takes back the thief's own offer first, then steals from the others.
+bool Context::steal(MarkWorker &thief) {
+    if (takeShared(thief, thief)) {
+        return true;
+    }
+    for (auto *victim : markWorkers) {
+        if (victim != &thief && takeShared(thief, *victim)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Context::anyShared() const {
+    for (auto *worker : markWorkers) {
+        if (worker->hasShared.load()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A worker only goes idle with empty private stacks and nothing left on
+// offer, and only the owner adds to its offer, so once every worker is idle
+// no work remains anywhere.
+void Context::runMarkWorker(size_t index) {
+    auto &self = *markWorkers[index];
+    for (;;) {
+        drain(self);
+        if (steal(self)) {
+            continue;
+        }
+        idleWorkers++;
+        for (;;) {
+            if (idleWorkers.load() == markWorkers.size()) {
+                return;
             }
+            if (anyShared()) {
+                idleWorkers--;
+                break;
+            }
+            this_thread::yield();
         }
     }
 }
 
-void Context::mark(Environment *current_env) {
-    if (usedEnvironments.count(current_env)) {
-        return;
+void Context::markInParallel() {
+    idleWorkers = 0;
+    parallelMarking = true;
+    vector<thread> threads;
+    for (size_t i = 1; i < markWorkers.size(); i++) {
+        threads.emplace_back(&Context::runMarkWorker, this, i);
     }
-    usedEnvironments.insert(current_env);
-    if (current_env->parent) {
-        mark(current_env->parent);
+    runMarkWorker(0);
+    for (auto &t : threads) {
+        t.join();
     }
-    if (current_env->caller) {
-        mark(current_env->caller);
+    parallelMarking = false;
+}
+
+void Context::drainMarkStack() {
+    while (helperWorkers.size() + 1 < markThreads) {
+        helperWorkers.push_back(unique_ptr<MarkWorker>(new MarkWorker()));
     }
-    for (const auto &binding : current_env->bindings) {
-        if (binding.second->type != ValueType::NONE) {
-            mark(binding.second);
+    markWorkers.assign(1, &mainWorker);
+    for (size_t i = 0; i + 1 < markThreads; i++) {
+        markWorkers.push_back(helperWorkers[i].get());
+    }
+    for (auto *worker : markWorkers) {
+        worker->markedBytes = 0;
+        fill(begin(worker->markedValues), end(worker->markedValues), 0);
+        worker->markedEnvironments = 0;
+    }
+    if (markWorkers.size() > 1) {
+        markInParallel();
+    } else {
+        drain(mainWorker);
+    }
+    for (auto *worker : markWorkers) {
+        foreignValues.insert(worker->foreignValues.begin(), worker->foreignValues.end());
+        foreignEnvironments.insert(worker->foreignEnvironments.begin(),
+                                   worker->foreignEnvironments.end());
+        worker->foreignValues.clear();
+        worker->foreignEnvironments.clear();
+    }
+}
+
+void Context::markRootStack() {
+    for (auto value : rootStack) {
+        if (value.isPointer() && !value.isNull() && value.asPointer()->type != ValueType::NONE) {
+            mark(value.asPointer());
         }
     }
+    if (completion.value && completion.value->type != ValueType::NONE) {
+        mark(completion.value);
+    }
+    if (completion.function) {
+        mark(const_cast<UserFunctionValue *>(completion.function));
+    }
+    if (arrayType) {
+        mark(arrayType);
+    }
+    for (auto value : completion.args) {
+        if (value->type != ValueType::NONE) {
+            mark(value);
+        }
+    }
+    for (const auto &item : completion.kwArgs) {
+        if (item.second->type != ValueType::NONE) {
+            mark(item.second);
+        }
+    }
+}
+
+void Context::remember(Value *owner) {
+    owner->remembered = true;
+    rememberedValues.push_back(owner);
+}
+
+void Context::remember(Environment *owner) {
+    owner->remembered = true;
+    rememberedEnvironments.push_back(owner);
+}
+
+void Context::clearRemembered() {
+    for (auto *value : rememberedValues) {
+        value->remembered = false;
+    }
+    for (auto *environment : rememberedEnvironments) {
+        environment->remembered = false;
+    }
+    rememberedValues.clear();
+    rememberedEnvironments.clear();
+}
+
+// Values that survive without being reachable from the roots.
+bool Context::keptAlive(Value *value) {
+    return value->refs || (value->type == ValueType::NONE);
 }
 
-void Context::markTempRefs() {
-    for (auto &ref : tempReferences) {
-        mark(ref);
+void Context::beginMark() {
+    markEpoch++;
+    if (markEpoch == 0) {
+        // Freshly allocated objects carry epoch zero.
+        markEpoch = 1;
     }
 }
 
-void Context::tempRefIncrement(Value *value) {
-    if (value->type != ValueType::NONE) {
-        tempReferences.insert(value);
+void Context::collectNow(Environment *current_env) {
+    auto start = chrono::steady_clock::now();
+    auto heap = heapBytes();
+    if (heap > peakHeapBytes) {
+        peakHeapBytes = heap;
     }
+    collectMinor(current_env);
+    if (promotedBytes >= collectionBudget) {
+        collectFull(current_env);
+    }
+    recordPause(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
 }
 
-void Context::tempRefDecrement(Value *value) {
-    if (value->type != ValueType::NONE) {
-        auto it = tempReferences.find(value);
-        if (it != tempReferences.end()) {
-            tempReferences.erase(it);
+void Context::recordPause(double milliseconds) {
+    totalPauseMs += milliseconds;
+    if (milliseconds > maxPauseMs) {
+        maxPauseMs = milliseconds;
+    }
+    size_t bucket = 0;
+    while (bucket + 1 < GCStats::PAUSE_BUCKETS &&
+           milliseconds * 1000 >= (double) ((size_t) 1 << bucket)) {
+        bucket++;
+    }
+    pauseHistogram[bucket]++;
+}
+
+size_t Context::heapBytes() {
+    size_t bytes = environmentPool.getSlabCount() * Slab::SIZE;
+    for (auto *pool : valuePools()) {
+        bytes += pool->getSlabCount() * Slab::SIZE;
+    }
+    return bytes;
+}
+
+GCStats Context::getStats() {
+    GCStats stats;
+    stats.collections = collections;
+    stats.minorCollections = minorCollections;
+    stats.totalPauseMs = totalPauseMs;
+    stats.maxPauseMs = maxPauseMs;
+    copy(begin(pauseHistogram), end(pauseHistogram), begin(stats.pauseHistogram));
+    stats.liveBytes = liveBytes;
+    copy(begin(liveValues), end(liveValues), begin(stats.liveValues));
+    stats.liveEnvironments = liveEnvironments;
+    stats.heapBytes = heapBytes();
+    stats.peakHeapBytes = max(peakHeapBytes, stats.heapBytes);
+    return stats;
+}
+
+string GCStats::toString() const {
+    stringstream out;
+    out << "メモリ掃除：" << collections << "回（小：" << minorCollections << "回）" << endl;
+    out << "停止時間：合計 " << totalPauseMs << "ms　最大 " << maxPauseMs << "ms" << endl;
+    out << "停止分布：";
+    for (size_t i = 0; i < PAUSE_BUCKETS; i++) {
+        if (pauseHistogram[i]) {
+            out << " <" << ((size_t) 1 << i) << "us:" << pauseHistogram[i];
+        }
+    }
+    out << endl;
+    out << "ヒープ：" << heapBytes << "バイト（最大 " << peakHeapBytes << "バイト）" << endl;
+    out << "最後の全掃除の生存：" << liveBytes << "バイト　環境：" << liveEnvironments;
+    for (size_t type = 0; type < ValueTypeCount; type++) {
+        if (liveValues[type]) {
+            out << "　" << ValueTypeStrings[type] << "：" << liveValues[type];
+        }
+    }
+    out << endl;
+    return out.str();
+}
+
+void Context::collectMinor(Environment *current_env) {
+    beginMark();
+    minorCollection = true;
+    mark(current_env);
+    markRootStack();
+    for (auto *value : rememberedValues) {
+        markChildren(mainWorker, value);
+    }
+    for (auto *environment : rememberedEnvironments) {
+        markChildren(mainWorker, environment);
+    }
+    drainMarkStack();
+    minorCollection = false;
+    clearRemembered();
+
+    for (auto *value : youngValues) {
+        if (value->mark == markEpoch || keptAlive(value)) {
+            value->young = false;
+            promotedBytes += value->memorySize();
         } else {
-            cout << "エラー：ワーニング：仮のメモリーが二倍消されました。" << value->toString() << endl;
+            SlabPool::release(value);
         }
     }
+    youngValues.clear();
+    for (auto *environment : youngEnvironments) {
+        if (environment->mark == markEpoch) {
+            environment->young = false;
+            promotedBytes += environment->memorySize();
+        } else {
+            SlabPool::release(environment);
+        }
+    }
+    youngEnvironments.clear();
+
+    collections++;
+    minorCollections++;
+    bytesSinceCollection = 0;
+    objectsSinceCollection = 0;
 }
 
-void Context::collect(Environment *current_env) {
-    iteration++;
-    if ((iteration % frequency != 0)) {
-        return;
+// Pool objects that died in the last full collection are left in place and
+// swept slab by slab as allocation needs room (see SlabPool::sweepLazily),
+// so the pause covers marking only. Allocation also paces the sweep, see
+// SWEEP_PACE.
+bool Context::isDeadValue(void *slot, void *context) {
+    auto self = (Context *) context;
+    auto value = (Value *) slot;
+    return value->mark != self->sweepEpoch && !self->keptAlive(value);
+}
+
+void Context::sweepPaced() {
+    while (sweepCredit >= SWEEP_PACE) {
+        sweepCredit -= SWEEP_PACE;
+        bool swept = environmentPool.sweepNext();
+        for (auto *pool : valuePools()) {
+            swept = pool->sweepNext() || swept;
+        }
+        if (!swept) {
+            sweepPending = false;
+            sweepCredit = 0;
+            return;
+        }
     }
+}
 
-    usedValues.clear();
-    usedEnvironments.clear();
+bool Context::isDeadEnvironment(void *slot, void *context) {
+    return ((Environment *) slot)->mark != ((Context *) context)->sweepEpoch;
+}
+
+void Context::collectFull(Environment *current_env) {
+    beginMark();
     mark(current_env);
-    markTempRefs();
-    for (auto *value : values) {
-        if (!usedValues.count(value)) {
-            if (value->refs ||
-                (value->type == ValueType::NUM && preallocNumbers.count(((NumberValue *) value)->value)) ||
-                (value->type == ValueType::NONE)) {
-                usedValues.insert(value);
-            } else {
-            }
+    markRootStack();
+    drainMarkStack();
+    clearRemembered();
+    size_t survivingBytes = 0;
+    fill(begin(liveValues), end(liveValues), 0);
+    liveEnvironments = 0;
+    for (auto *worker : markWorkers) {
+        survivingBytes += worker->markedBytes;
+        for (size_t type = 0; type < ValueTypeCount; type++) {
+            liveValues[type] += worker->markedValues[type];
+        }
+        liveEnvironments += worker->markedEnvironments;
+    }
+
+    sweepEpoch = markEpoch;
+    for (auto *value : youngValues) {
+        if (value->mark == markEpoch || keptAlive(value)) {
+            value->young = false;
+        }
+    }
+    youngValues.clear();
+    for (auto *environment : youngEnvironments) {
+        if (environment->mark == markEpoch) {
+            environment->young = false;
+        }
+    }
+    youngEnvironments.clear();
+    for (auto *pool : valuePools()) {
+        pool->sweepLazily(isDeadValue, this);
+    }
+    environmentPool.sweepLazily(isDeadEnvironment, this);
+    sweepPending = true;
+    sweepCredit = 0;
+
+    for (auto it = foreignValues.begin(); it != foreignValues.end();) {
+        auto value = *it;
+        if (value->mark == markEpoch || keptAlive(value)) {
+            ++it;
         } else {
+            delete value;
+            it = foreignValues.erase(it);
         }
     }
-    values = usedValues;
-    for (auto *environment : environments) {
-        if (!usedEnvironments.count(environment)) {
+    for (auto it = foreignEnvironments.begin(); it != foreignEnvironments.end();) {
+        auto environment = *it;
+        if (environment->mark == markEpoch) {
+            ++it;
+        } else {
             delete environment;
+            it = foreignEnvironments.erase(it);
         }
     }
-    environments = usedEnvironments;
+
+    collections++;
+    liveBytes = survivingBytes;
+    promotedBytes = 0;
+    bytesSinceCollection = 0;
+    objectsSinceCollection = 0;
+    updateCollectionBudget();
+}
+
+void Context::updateCollectionBudget() {
+    auto budget = (size_t) ((double) liveBytes * (growthFactor - 1.0));
+    collectionBudget = budget > minimumHeap ? budget : minimumHeap;
 }
 
 void Context::cleanup() {
-    for (auto value : values) {
+    // Functions and frames share their Code, which unpins its constants
+    // when the last of them goes, so they must go before the constants.
+    userFunctionPool.clear();
+    environmentPool.clear();
+    for (auto environment : foreignEnvironments) {
+        delete environment;
+    }
+    for (auto *pool : valuePools()) {
+        pool->clear();
+    }
+    characters.clear();
+    arrayType = nullptr;
+    for (auto value : foreignValues) {
         if (value->type == ValueType::NONE) {
             // None is the only statically allocated type
             continue;
         }
         delete value;
     }
-    for (auto environment : environments) {
-        delete environment;
+    foreignValues.clear();
+    foreignEnvironments.clear();
+    youngValues.clear();
+    youngEnvironments.clear();
+    rememberedValues.clear();
+    rememberedEnvironments.clear();
+}
+
+const Code *Context::compile(SyntaxNode *tree) {
+    if (!tree->code) {
+        tree->code = shared_ptr<Code>(Compiler().compile(tree));
     }
+    return tree->code.get();
 }
 
 void Context::setFrequency(long freq) {
     frequency = freq;
 }
 
+void Context::setGrowthFactor(double factor) {
+    growthFactor = factor > 1.0 ? factor : 1.0;
+    updateCollectionBudget();
+}
+
+void Context::setNurserySize(size_t bytes) {
+    nurserySize = bytes;
+}
+
+void Context::setMarkThreads(unsigned threads) {
+    markThreads = threads > 0 ? threads : 1;
+}
+
+void Context::setMinimumHeap(size_t bytes) {
+    minimumHeap = bytes;
+    updateCollectionBudget();
+}
+
 //TODO: Often accessed through instance.
 Value *Context::newNoneValue() {
     static Value staticNone(ValueType::NONE);
     return &staticNone;
 }
 
+Value *Context::unwindSignal() {
+    static Value signal(ValueType::RETURN);
+    return &signal;
+}
+
+bool Context::tailCallable(const FunctionValue *function) {
+    while (function->functionType == FunctionValueType::BOUND_FUNCTION) {
+        function = static_cast<const BoundFunctionValue *>(function)->function;
+    }
+    return function->functionType == FunctionValueType::USER_FUNCTION;
+}
+
+Value *Context::signalTailCall(const FunctionValue *function, TailPosition position) {
+    while (function->functionType == FunctionValueType::BOUND_FUNCTION) {
+        auto bound = static_cast<const BoundFunctionValue *>(function);
+        completion.args.insert(completion.args.begin(), bound->jibun);
+        function = bound->function;
+    }
+    completion.status = Completion::TAIL_CALL;
+    completion.function = static_cast<const UserFunctionValue *>(function);
+    completion.dropResult = position == TailPosition::LAST;
+    return unwindSignal();
+}
+
+// Native stack the calls may use, leaving a quarter of it for the builtins
+// and the evaluation between two calls.
+static size_t nativeStackBudget() {
+    size_t size = 1024 * 1024;
+#ifndef _WIN32
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0) {
+        size = limit.rlim_cur == RLIM_INFINITY ? 64 * 1024 * 1024 : (size_t) limit.rlim_cur;
+    }
+#endif
+    return size / 4 * 3;
+}
+
+bool Context::enterCall(Environment *env) {
+    char here;
+    if (callDepth == 0) {
+        stackBase = &here;
+        if (maxStackBytes == 0) {
+            maxStackBytes = nativeStackBudget();
+        }
+    }
+    size_t stackUsed = stackBase > &here ? stackBase - &here : &here - stackBase;
+    if (callDepth >= maxCallDepth) {
+        env->logger->log("実行エラー：呼び出しが深すぎます。最大は")
+                ->logLong((long) maxCallDepth)->log("です。")->logEndl();
+        completion.status = Completion::ERROR;
+        return false;
+    }
+    if (stackUsed > maxStackBytes) {
+        env->logger->log("実行エラー：呼び出しが深すぎます。スタックが足りません。-bで実行してください。")->logEndl();
+        completion.status = Completion::ERROR;
+        return false;
+    }
+    callDepth++;
+    return true;
+}
+
+Value *Context::completedValue(Value *result) {
+    if (result != unwindSignal()) {
+        return result;
+    }
+    if (completion.status == Completion::ERROR) {
+        completion.status = Completion::NORMAL;
+        return newNoneValue();
+    }
+    if (completion.status != Completion::RETURN) {
+        return result;
+    }
+    Value *value = completion.value;
+    completion.status = Completion::NORMAL;
+    completion.value = nullptr;
+    return value;
+}
+
 NumberValue *Context::newNumberValue(long number) {
-    if (preallocNumbers.count(number)) {
-        return preallocNumbers[number];
+    if (number >= SMALL_NUMBER_MIN && number <= SMALL_NUMBER_MAX &&
+        smallNumbers[number - SMALL_NUMBER_MIN]) {
+        return smallNumbers[number - SMALL_NUMBER_MIN];
     }
-    auto result = new NumberValue(number);
-    values.insert(result);
-    preallocNumbers[number] = result;
-    return result;
+    return allocateYoung(new(numberPool.allocate()) NumberValue(number));
 }
 
 FloatValue *Context::newFloatValue(double number) {
-    auto result = new FloatValue(number);
-    values.insert(result);
+    auto result = allocateYoung(new(floatPool.allocate()) FloatValue(number));
     return result;
 }
 
-StringValue *Context::newStringValue(wstring str) {
-    auto result = new StringValue(std::move(str));
-    values.insert(result);
+StringValue *Context::newCharacterValue(wchar_t character) {
+    auto existing = characters.find(character);
+    if (existing != characters.end()) {
+        return existing->second;
+    }
+    auto result = new(stringPool.allocate()) StringValue(CompactString(wstring(1, character)));
+    result->managed = true;
+    result->refs++;
+    characters[character] = result;
+    return result;
+}
+
+StringValue *Context::newStringValue(const wstring &str) {
+    return newStringValue(CompactString(str));
+}
+
+StringValue *Context::newStringValue(CompactString str) {
+    auto result = allocateYoung(new(stringPool.allocate()) StringValue(std::move(str)));
     return result;
 }
 
 DictionaryValue *Context::newDictionaryValue() {
-    auto result = new DictionaryValue();
-    values.insert(result);
+    auto result = allocateYoung(new(dictionaryPool.allocate()) DictionaryValue(&rootShape));
+    result->context = this;
     return result;
 }
 
 UserFunctionValue *Context::newUserFunctionValue(
-        vector<wstring> params, SyntaxNode *body, Environment *e) {
-    auto result = new UserFunctionValue(std::move(params), body, e);
-    values.insert(result);
+        vector<Symbol> params, SyntaxNode *body, Environment *e) {
+    auto result = allocateYoung(new(userFunctionPool.allocate()) UserFunctionValue(std::move(params), body, e));
     return result;
 }
 
 UserFunctionValue *Context::newUserFunctionValue(
-        vector<wstring> params, unordered_map<wstring, Value *> paramsWithDefault,
+        vector<Symbol> params, unordered_map<Symbol, Value *> paramsWithDefault,
         SyntaxNode *body, Environment *e) {
-    auto result = new UserFunctionValue(std::move(params),
-                                        std::move(paramsWithDefault), body, e);
-    values.insert(result);
+    auto result = allocateYoung(new(userFunctionPool.allocate()) UserFunctionValue(
+            std::move(params), std::move(paramsWithDefault), body, e));
     return result;
 }
 
 FunctionValue *Context::newBoundFunctionValue(FunctionValue *function, Value *jibun) {
-    auto result = new BoundFunctionValue(function, jibun);
-    values.insert(result);
+    auto result = allocateYoung(new(boundFunctionPool.allocate()) BoundFunctionValue(function, jibun));
     return result;
 }
 
 ArrayValue *Context::newArrayValue(Environment *env) {
-    auto result = new ArrayValue();
-    values.insert(result);
-    result->setParent(static_cast<DictionaryValue *>(env->lookup(L"配列型")));
+    auto result = allocateYoung(new(arrayPool.allocate()) ArrayValue());
+    result->context = this;
+    if (arrayType == nullptr) {
+        Value *type = env->lookup(L"配列型");
+        if (type->type == ValueType::DICT) {
+            arrayType = static_cast<DictionaryValue *>(type);
+        }
+    }
+    result->setParent(arrayType);
     return result;
 }
 
 Environment *Context::newChildEnvironment(Environment *e) {
-    auto result = new Environment(e);
-    environments.insert(result);
+    auto result = new(environmentPool.allocate()) Environment(e);
+    result->young = true;
+    result->managed = true;
+    youngEnvironments.push_back(result);
+    recordAllocation(sizeof(Environment));
     return result;
 }
 
-Context::Context() {
-    for (long i = 0; i < 255; i++) {
-        auto numberValue = newNumberValue(i);
+Context::Context()
+        : numberPool(sizeof(NumberValue), nullptr),
+          floatPool(sizeof(FloatValue), nullptr),
+          stringPool(sizeof(StringValue), destroyValue),
+          dictionaryPool(sizeof(DictionaryValue), destroyValue),
+          arrayPool(sizeof(ArrayValue), destroyValue),
+          userFunctionPool(sizeof(UserFunctionValue), destroyValue),
+          boundFunctionPool(sizeof(BoundFunctionValue), destroyValue),
+          environmentPool(sizeof(Environment), destroyEnvironment) {
+    // Shared small numbers start out old and pinned; they are not counted
+    // against the first collection's budget.
+    for (long i = SMALL_NUMBER_MIN; i <= SMALL_NUMBER_MAX; i++) {
+        auto numberValue = new(numberPool.allocate()) NumberValue(i);
+        numberValue->managed = true;
         numberValue->refs++;
-        preallocNumbers[i] = numberValue;
+        smallNumbers[i - SMALL_NUMBER_MIN] = numberValue;
     }
 }
@@ -1,58 +1,418 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <unordered_set>
 
 #include "Environment.h"
+#include "Allocator.h"
+
+class Code;
+
+// Marking state of one thread. The private stacks are only touched by the
+// owning thread; work offered to other threads is moved to the shared stacks,
+// which are guarded by `lock`.
+struct MarkWorker {
+    vector<Value *> values;
+    vector<Environment *> environments;
+    mutex lock;
+    vector<Value *> sharedValues;
+    vector<Environment *> sharedEnvironments;
+    atomic<bool> hasShared{false};
+    // Unmanaged objects reached by this worker, adopted after marking.
+    vector<Value *> foreignValues;
+    vector<Environment *> foreignEnvironments;
+    size_t markedBytes = 0;
+    size_t markedValues[ValueTypeCount] = {};
+    size_t markedEnvironments = 0;
+};
+
+// Collector statistics since the Context was created. Live sizes and counts
+// are those found by the most recent full collection.
+struct GCStats {
+    static const size_t PAUSE_BUCKETS = 16;
+
+    long collections = 0;
+    long minorCollections = 0;
+    double totalPauseMs = 0;
+    double maxPauseMs = 0;
+    // pauseHistogram[i] counts pauses shorter than 2^i microseconds that
+    // did not fit an earlier bucket; the last bucket also takes the rest.
+    long pauseHistogram[PAUSE_BUCKETS] = {};
+    size_t liveBytes = 0;
+    size_t liveValues[ValueTypeCount] = {};
+    size_t liveEnvironments = 0;
+    // Bytes held by the slab pools, now and at the start of the largest
+    // collection so far.
+    size_t heapBytes = 0;
+    size_t peakHeapBytes = 0;
+
+    string toString() const;
+};
+
+// How the function body that just stopped running finished. 返す and tail
+// calls leave their outcome here and unwind the evaluators with
+// Context::unwindSignal(), so neither allocates; UserFunctionValue::apply
+// picks the outcome up. Pending values are roots until then.
+//
+// ERROR unwinds every pin call up to the program being evaluated, see
+// completedValue; calls made while it is pending return None at once.
+struct Completion {
+    enum Status { NORMAL, RETURN, TAIL_CALL, ERROR };
+
+    Status status = NORMAL;
+    // Result of 返す.
+    Value *value = nullptr;
+    // Callee of a tail call, with bound functions already unwrapped into
+    // their receiver argument.
+    const UserFunctionValue *function = nullptr;
+    // Set when the tail call was a statement whose value is dropped, so the
+    // chain of calls it starts returns None.
+    bool dropResult = false;
+    // Arguments of a tail call. Reused from call to call so their storage
+    // is only allocated while it grows.
+    vector<Value *> args;
+    unordered_map<Symbol, Value *> kwArgs;
+};
 
 // Manages Memory and object lifecycle
+//
+// The heap has two generations. New objects are placed in the nursery
+// (youngValues / youngEnvironments); a minor collection marks only young
+// objects, using the remembered set for old objects that were written a
+// young reference since the last collection, and promotes every survivor.
+// The old generation is only walked by a full collection.
+//
+// Objects are carved out of per-type slab pools. After a full collection the
+// pools sweep their slabs lazily, one at a time as allocation needs room, so
+// the pause covers marking only. Objects created outside the Context (builtin
+// functions, the global environment) are adopted into the foreign sets the
+// first time they are marked so that cleanup can release them.
 class Context {
-    unordered_map<long, NumberValue *> preallocNumbers;
-    unordered_set<Value *> values;
-    unordered_set<Environment *> environments;
-    unordered_multiset<Value *> tempReferences;
+    friend class RootScope;
+    friend class VM;
+
+    // Integers in this range are allocated once and shared; all others are
+    // ordinary collectable values.
+    static const long SMALL_NUMBER_MIN = -128;
+    static const long SMALL_NUMBER_MAX = 1023;
+    NumberValue *smallNumbers[SMALL_NUMBER_MAX - SMALL_NUMBER_MIN + 1];
+    // One-character strings, made on first use and then shared and pinned
+    // like the small numbers. Bounded by the characters a program uses.
+    unordered_map<wchar_t, StringValue *> characters;
+    // 配列型, looked up by the first array made once core.pin defined it
+    // and given to every array after that. Marked as a root.
+    DictionaryValue *arrayType = nullptr;
+    // Values held only by native code, see RootScope, and the operand stack
+    // of the VM.
+    vector<Word> rootStack;
+    // Empty layout every dictionary starts from; owns the whole shape tree.
+    Shape rootShape;
 
+    SlabPool numberPool;
+    SlabPool floatPool;
+    SlabPool stringPool;
+    SlabPool dictionaryPool;
+    SlabPool arrayPool;
+    SlabPool userFunctionPool;
+    SlabPool boundFunctionPool;
+    SlabPool environmentPool;
+    unordered_set<Value *> foreignValues;
+    unordered_set<Environment *> foreignEnvironments;
+
+    vector<Value *> youngValues;
+    vector<Environment *> youngEnvironments;
+    vector<Value *> rememberedValues;
+    vector<Environment *> rememberedEnvironments;
+    bool minorCollection = false;
+    // Objects whose mark equals the current epoch are reachable in the
+    // collection in progress; bumping the epoch unmarks everything at once.
+    uint32_t markEpoch = 0;
+    // Epoch of the last full collection, whose dead objects the pools are
+    // still sweeping lazily.
+    uint32_t sweepEpoch = 0;
+    // Besides sweeping when a pool runs out of free slots, one pending slab
+    // is swept for every SWEEP_PACE bytes allocated from any pool, so that
+    // dead objects holding buffers outside the slabs, such as arrays and
+    // strings, are freed in step with allocation.
+    static const size_t SWEEP_PACE = 16 * 1024;
+    bool sweepPending = false;
+    size_t sweepCredit = 0;
+    // Grey objects waiting to have their children scanned. With more than
+    // one mark thread, the helpers steal work from each other's stacks.
+    MarkWorker mainWorker;
+    vector<unique_ptr<MarkWorker>> helperWorkers;
+    vector<MarkWorker *> markWorkers;
+    unsigned markThreads = 1;
+    bool parallelMarking = false;
+    atomic<size_t> idleWorkers{0};
+
+    // Collection is triggered by allocation volume: once the bytes allocated
+    // since the last cycle fill the nursery, the next eval safepoint runs a
+    // minor collection. Once the bytes promoted since the last full
+    // collection exceed the budget, a full mark and sweep follows. The budget
+    // is recomputed after each full cycle from the surviving heap size and
+    // the growth factor.
+    size_t bytesSinceCollection = 0;
+    size_t objectsSinceCollection = 0;
+    size_t promotedBytes = 0;
+    size_t liveBytes = 0;
+    size_t minimumHeap = 4 * 1024 * 1024;
+    size_t nurserySize = 1024 * 1024;
+    double growthFactor = 2.0;
+    size_t collectionBudget = minimumHeap;
+    long collections = 0;
+    long minorCollections = 0;
+    double totalPauseMs = 0;
+    double maxPauseMs = 0;
+    long pauseHistogram[GCStats::PAUSE_BUCKETS] = {};
+    size_t liveValues[ValueTypeCount] = {};
+    size_t liveEnvironments = 0;
+    size_t peakHeapBytes = 0;
+
+    // Pin calls in progress, counting both the VM's inline frames and
+    // nested applies.
+    size_t callDepth = 0;
+    size_t maxCallDepth = 1000000;
+    // Native stack address of the outermost call and how far below it the
+    // tree walker's nested applies may go before failing like a too deep call.
+    const char *stackBase = nullptr;
+    size_t maxStackBytes = 0;
+
+    bool bytecode = false;
+
+    // Debugging aid: when non-zero, collect every `frequency` evals regardless
+    // of the allocation budget.
     long iteration = 0;
-    long frequency = 1;
+    long frequency = 0;
 
-public:
-    unordered_set<Value *> usedValues;
-    unordered_set<Environment *> usedEnvironments;
+    void recordAllocation(size_t bytes) {
+        bytesSinceCollection += bytes;
+        objectsSinceCollection++;
+        paceSweep(bytes);
+    }
 
-    Context();
+    void paceSweep(size_t bytes) {
+        if (sweepPending) {
+            sweepCredit += bytes;
+            if (sweepCredit >= SWEEP_PACE) {
+                sweepPaced();
+            }
+        }
+    }
+
+    void sweepPaced();
+
+    template<typename T>
+    T *allocateYoung(T *value) {
+        value->young = true;
+        value->managed = true;
+        youngValues.push_back(value);
+        recordAllocation(value->memorySize());
+        return value;
+    }
+
+    size_t heapBytes();
+
+    void recordPause(double milliseconds);
+
+    vector<SlabPool *> valuePools() {
+        return {&numberPool, &floatPool, &stringPool, &dictionaryPool,
+                &arrayPool, &userFunctionPool, &boundFunctionPool};
+    }
+
+    bool collectionDue() {
+        if (frequency) {
+            return (++iteration % frequency) == 0;
+        }
+        return bytesSinceCollection >= nurserySize ||
+               bytesSinceCollection >= collectionBudget;
+    }
+
+    void collectNow(Environment *current_env);
+
+    void beginMark();
+
+    void collectMinor(Environment *current_env);
+
+    void collectFull(Environment *current_env);
+
+    static bool isDeadValue(void *slot, void *context);
+
+    static bool isDeadEnvironment(void *slot, void *context);
+
+    bool claim(uint32_t &mark);
+
+    void push(MarkWorker &worker, Value *value);
+
+    void push(MarkWorker &worker, Environment *environment);
+
+    void markChildren(MarkWorker &worker, Value *value);
+
+    void markChildren(MarkWorker &worker, Environment *env);
+
+    void drain(MarkWorker &worker);
+
+    void share(MarkWorker &worker);
+
+    bool takeShared(MarkWorker &thief, MarkWorker &victim);
+
+    bool steal(MarkWorker &thief);
+
+    bool anyShared() const;
+
+    void runMarkWorker(size_t index);
+
+    void markInParallel();
 
-    void tempRefIncrement(Value *value);
+    void drainMarkStack();
 
-    void tempRefDecrement(Value *value);
+    bool keptAlive(Value *value);
 
+    void clearRemembered();
+
+    void updateCollectionBudget();
+
+public:
+    Completion completion;
+
+    Context();
+
+    // Queues an object for marking; the work happens when the collector
+    // drains its mark stack.
     void mark(Value *value);
 
     void mark(Environment *current_env);
 
-    void markTempRefs();
+    void markRootStack();
 
-    void collect(Environment *current_env);
+    // Write barrier targets: called when an old object is made to reference
+    // a young value.
+    void remember(Value *owner);
+
+    void remember(Environment *owner);
+
+    // Safepoint: collects only when the allocation budget is exhausted.
+    void collect(Environment *current_env) {
+        if (collectionDue()) {
+            collectNow(current_env);
+        }
+    }
 
     void cleanup();
 
     void setFrequency(long freq);
 
+    void setGrowthFactor(double factor);
+
+    void setMinimumHeap(size_t bytes);
+
+    // Number of threads used for the mark phase; 1 marks on the calling
+    // thread only.
+    void setMarkThreads(unsigned threads);
+
+    void setNurserySize(size_t bytes);
+
+    long getCollectionCount() const { return collections; }
+
+    long getMinorCollectionCount() const { return minorCollections; }
+
+    size_t getLiveBytes() const { return liveBytes; }
+
+    size_t getBytesSinceCollection() const { return bytesSinceCollection; }
+
+    // Charges memory an object gained after it was allocated, such as a
+    // grown array buffer, to the collection budget.
+    void recordGrowth(size_t bytes) {
+        bytesSinceCollection += bytes;
+        paceSweep(bytes);
+    }
+
+    GCStats getStats();
+
+    // Deepest pin recursion allowed before the call fails with an error
+    // instead of exhausting memory. The VM keeps its frames on the heap; the
+    // tree walker nests native frames, so it also fails once they use most of
+    // the native stack, whichever comes first.
+    void setMaxCallDepth(size_t depth) { maxCallDepth = depth; }
+
+    // Counts a pin call about to start. Past the maximum depth, or too close
+    // to the end of the native stack, it reports the error through `env`,
+    // starts Completion::ERROR and returns false.
+    bool enterCall(Environment *env);
+
+    void leaveCall() { callDepth--; }
+
+    // Runs programs on the bytecode VM instead of walking the syntax tree.
+    // Must be set before anything is evaluated.
+    void setBytecode(bool enabled) { bytecode = enabled; }
+
+    bool usesBytecode() const { return bytecode; }
+
+    // Bytecode for `tree`, compiled the first time and kept on the tree.
+    const Code *compile(SyntaxNode *tree);
+
     static Value *newNoneValue();
 
+    // Marker returned through eval and VM::run while `completion` holds
+    // the outcome of a body that stopped early. Never stored anywhere.
+    static Value *unwindSignal();
+
+    Value *signalReturn(Value *value) {
+        if (completion.status == Completion::ERROR) {
+            return unwindSignal();
+        }
+        completion.status = Completion::RETURN;
+        completion.value = value;
+        return unwindSignal();
+    }
+
+    // Calls in tail position are only left to UserFunctionValue::apply when
+    // they end up in a user function; builtins are called in place.
+    static bool tailCallable(const FunctionValue *function);
+
+    // The arguments must already be in `completion`.
+    Value *signalTailCall(const FunctionValue *function, TailPosition position);
+
+    // What a body or program evaluated to: the value of its 返す when it
+    // returned `result` == unwindSignal(), `result` itself otherwise. A
+    // pending error ends here, with None as the value.
+    Value *completedValue(Value *result);
+
     NumberValue *newNumberValue(long number);
 
     FloatValue *newFloatValue(double number);
 
-    StringValue *newStringValue(wstring str);
+    // The Value a word stands for: its pointer, or a new number or None.
+    Value *box(Word word) {
+        if (word.isPointer()) {
+            return word.asPointer();
+        } else if (word.isInt()) {
+            return newNumberValue(word.asInt());
+        } else if (word.isFloat()) {
+            return newFloatValue(word.asFloat());
+        }
+        return newNoneValue();
+    }
+
+    StringValue *newStringValue(const wstring &str);
+
+    StringValue *newStringValue(CompactString str);
+
+    // The shared string of just `character`; never allocates after the
+    // first time.
+    StringValue *newCharacterValue(wchar_t character);
 
     DictionaryValue *newDictionaryValue();
 
     UserFunctionValue *newUserFunctionValue(
-            vector<wstring> params, SyntaxNode *body, Environment *e);
+            vector<Symbol> params, SyntaxNode *body, Environment *e);
 
     UserFunctionValue *newUserFunctionValue(
-            vector<wstring> params,
-            unordered_map<wstring, Value *> paramsWithDefault,
+            vector<Symbol> params,
+            unordered_map<Symbol, Value *> paramsWithDefault,
             SyntaxNode *body, Environment *e);
 
     FunctionValue *newBoundFunctionValue(FunctionValue *function, Value *jibun);
@@ -62,4 +422,42 @@ public:
     Environment *newChildEnvironment(Environment *e);
 };
 
+// Keeps values that native code holds in locals alive across anything that
+// may reach a collection safepoint. Everything pushed through a scope is
+// popped when the scope ends, so pushes and pops cannot get out of step.
+class RootScope {
+    Context *context;
+    size_t depth;
+
+public:
+    explicit RootScope(Context *context)
+            : context(context), depth(context->rootStack.size()) {}
+
+    ~RootScope() {
+        context->rootStack.resize(depth);
+    }
+
+    RootScope(const RootScope &) = delete;
+
+    RootScope &operator=(const RootScope &) = delete;
+
+    template<typename T>
+    T *push(T *value) {
+        context->rootStack.push_back(value);
+        return value;
+    }
+
+    // Overwrites the `index`-th value pushed through this scope.
+    template<typename T>
+    T *replace(size_t index, T *value) {
+        context->rootStack[depth + index] = value;
+        return value;
+    }
+
+    // The values pushed through this scope, oldest first.
+    const Word *begin() const {
+        return context->rootStack.data() + depth;
+    }
+};
+
 #endif
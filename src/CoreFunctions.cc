@@ -4,6 +4,7 @@
 #include "InputSource.h"
 #include "Extension.h"
 #include "CoreFunctions.h"
+#include "Optimizer.h"
 
 #include <iostream>
 
@@ -16,7 +17,7 @@ class FunctionSum : public FunctionValue {
 public:
 
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         long result = 0;
         for (auto value : args) {
             result += value->toNumberValue()->value;
@@ -29,7 +30,7 @@ class FunctionDiff : public FunctionValue {
 public:
 
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         long result = 0;
         bool first = true;
         for (auto value : args) {
@@ -48,7 +49,7 @@ class FunctionDiv : public FunctionValue {
 public:
 
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         long result = 0;
         bool first = true;
         for (auto value : args) {
@@ -67,7 +68,7 @@ class FunctionMul : public FunctionValue {
 public:
 
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         long result = 0;
         bool first = true;
         for (auto value : args) {
@@ -89,12 +90,12 @@ public:
     ~FunctionPrint() override {}
 
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         for (auto value : args) {
             if (value->type == ValueType::NUM) {
                 env->logger->logLong(value->toNumberValue()->value);
             } else if (value->type == ValueType::STRING) {
-                env->logger->log(value->toStringValue()->value);
+                env->logger->log(value->toStringValue()->value.toUTF8());
             } else {
                 env->logger->log(value->toString());
             }
@@ -108,7 +109,7 @@ class FunctionEqual : public FunctionValue {
 public:
 
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         if (args[0]->equals(args[1])) {
             return env->context->newNumberValue(1);
         }
@@ -120,7 +121,7 @@ class FunctionCompare : public FunctionValue {
 public:
 
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         if ((args[0]->type != ValueType::NUM) ||
             (args[1]->type != ValueType::NUM)) {
             return env->context->newNumberValue(0);
@@ -133,10 +134,11 @@ public:
 
 Value *FunctionNewDictionary::apply(const vector<Value *> &args,
                                     Environment *env,
-                                    unordered_map<wstring, Value *> *kwargs) const {
+                                    unordered_map<Symbol, Value *> *kwargs) const {
     auto result = env->context->newDictionaryValue();
     if (!args.empty() && result->type == ValueType::DICT) {
-        result->setParent(args[0]->toDictionaryValue());
+        // An array's own members are those of its type.
+        result->setParent(args[0]->getLookupSource(env));
     }
     if (kwargs) {
         for (auto &arg : *kwargs) {
@@ -148,42 +150,36 @@ Value *FunctionNewDictionary::apply(const vector<Value *> &args,
 
 Value *FunctionForEach::apply(const vector<Value *> &args,
                               Environment *env,
-                              unordered_map<wstring, Value *> *) const {
+                              unordered_map<Symbol, Value *> *) const {
     if (args.size() == 2 && args[1]->type == ValueType::FUNC) {
         if (args[0]->type == ValueType::DICT) {
             auto dictionary = args[0]->toDictionaryValue();
             auto function = (FunctionValue *) args[1];
-            vector<wstring> keys;
-            for (const auto &item : dictionary->value) {
-                keys.push_back(item.first);
-            }
+            vector<CompactString> keys = dictionary->keys();
             for (const auto &key : keys) {
-                auto value = dictionary->value[key];
+                auto value = dictionary->getOwnEntry(key);
                 function->apply({env->context->newStringValue(key), value}, env);
             }
             return Context::newNoneValue();
         } else if (args[0]->type == ValueType::ARRAY) {
             auto array = (ArrayValue *) args[0];
             auto function = (FunctionValue *) args[1];
+            RootScope roots(env->context);
             vector<Value *> keys;
             for (const auto &item : array->value) {
-                keys.push_back(item);
-                item->refs++;
+                keys.push_back(roots.push(env->context->box(item)));
             }
             for (const auto &key : keys) {
                 function->apply({key}, env);
-                key->refs--;
             }
             return Context::newNoneValue();
         } else if (args[0]->type == ValueType::STRING) {
-            auto s = args[0]->toStringValue();
+            // A copy shares the characters and keeps them even if the
+            // StringValue is collected meanwhile.
+            CompactString characters = args[0]->toStringValue()->value;
             auto function = (FunctionValue *) args[1];
-            vector<wstring> keys;
-            for (wchar_t &c : s->value) {
-                keys.emplace_back(1, c);
-            }
-            for (const auto &key : keys) {
-                function->apply({env->context->newStringValue(key)}, env);
+            for (size_t i = 0; i < characters.length(); i++) {
+                function->apply({env->context->newCharacterValue(characters[i])}, env);
             }
             return Context::newNoneValue();
         } else if (args[0]->type == ValueType::NUM) {
@@ -201,12 +197,11 @@ Value *FunctionForEach::apply(const vector<Value *> &args,
 class FunctionReadFile : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         if (args.size() != 1) {
             return Context::newNoneValue();
         }
-        wstring fileName = args[0]->toStringValue()->value;
-        FileInputSource fileInputSource(encodeUTF8(fileName).c_str());
+        FileInputSource fileInputSource(args[0]->toStringValue()->value.toUTF8().c_str());
         wstring sourceCode;
         wchar_t newChar;
         while ((newChar = fileInputSource.getChar()) != -1) {
@@ -219,18 +214,19 @@ public:
 class FunctionEval : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         if (args.size() != 1) {
             return Context::newNoneValue();
         }
         auto moduleEnv = env->newChildEnvironment();
-        wstring text = args[0]->toStringValue()->value;
+        wstring text = args[0]->toStringValue()->value.toWString();
         StringInputSource inputSource(text.c_str());
         InputSourceTokenizer tokenizer(&inputSource);
         ConsoleLogger logger;
         Parser parser(&tokenizer, &logger);
         SyntaxNode *ast = parser.run();
-        moduleEnv->eval(ast);
+        Optimizer(env->context).optimize(ast);
+        env->context->completedValue(moduleEnv->eval(ast));
         delete ast;
         return moduleEnv->toNewDictionaryValue();
     };
@@ -239,9 +235,8 @@ public:
 class FunctionLoadExt : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
-        wstring name = args[0]->toStringValue()->value;
-        loadDynamic(env, encodeUTF8(name).c_str());
+                 unordered_map<Symbol, Value *> *) const override {
+        loadDynamic(env, args[0]->toStringValue()->value.toUTF8().c_str());
         return Context::newNoneValue();
     };
 };
@@ -249,7 +244,7 @@ public:
 class LengthFunction : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         if (args[0]->type == ValueType::ARRAY) {
             auto *array = (ArrayValue *) (args[0]);
             return env->context->newNumberValue(array->length());
@@ -264,7 +259,7 @@ public:
 class IndexFunction : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         auto *array = (ArrayValue *) (args[0]);
         auto *index = (NumberValue *) (args[1]);
         return array->getIndex(index->value);
@@ -274,7 +269,7 @@ public:
 class ArrayUpdate : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         auto *array = (ArrayValue *) (args[0]);
         auto *index = (NumberValue *) (args[1]);
         auto newValue = args[2];
@@ -286,7 +281,7 @@ public:
 class ArrayAdd : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *e,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         if (args[0]->type != ValueType::ARRAY ) {
             return e->context->newNoneValue();
         }
@@ -300,7 +295,7 @@ public:
 //class ArrayInsert : public FunctionValue {
 //public:
 //    Value *apply(const vector<Value *> &args, Environment *,
-//                 unordered_map<wstring, Value *> *) const override {
+//                 unordered_map<Symbol, Value *> *) const override {
 //        auto *array = (ArrayValue*)(args[0]);
 //        auto *index = (NumberValue*)(args[1]);
 //        auto newValue = args[2];
@@ -311,18 +306,18 @@ public:
 
 class DictLookup : public FunctionValue {
 public:
-    Value *apply(const vector<Value *> &args, Environment *,
-                 unordered_map<wstring, Value *> *) const override {
-        auto *dict = args[0]->toDictionaryValue();
+    Value *apply(const vector<Value *> &args, Environment *env,
+                 unordered_map<Symbol, Value *> *) const override {
+        auto *dict = args[0]->getLookupSource(env);
         StringValue *key = args[1]->toStringValue();
-        return dict->get(key->value);
+        return dict ? dict->getEntry(key->value) : nullptr;
     };
 };
 
 class ModFunction : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         auto *arg1 = args[0];
         auto *arg2 = args[1];
         return env->context->newNumberValue(arg1->toNumberValue()->value % arg2->toNumberValue()->value);
@@ -332,7 +327,7 @@ public:
 class FunctionSetParent : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         auto *arg0 = args[0];
         auto *arg1 = args[1];
         if (!(arg0->type == ValueType::ARRAY || arg0->type == ValueType::DICT) ||
@@ -340,9 +335,12 @@ public:
             // TODO: log error
             return env->context->newNoneValue();
         }
-        DictionaryValue *dict = static_cast<DictionaryValue *> (arg0);
         DictionaryValue *parentDict = static_cast<DictionaryValue *> (arg1);
-        dict->setParent(parentDict);
+        if (arg0->type == ValueType::ARRAY) {
+            static_cast<ArrayValue *>(arg0)->setParent(parentDict);
+        } else {
+            static_cast<DictionaryValue *>(arg0)->setParent(parentDict);
+        }
         return env->context->newNoneValue();
     };
 };
@@ -350,12 +348,40 @@ public:
 class FunctionGetType : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *) const override {
+                 unordered_map<Symbol, Value *> *) const override {
         auto *arg0 = args[0];
         return arg0->getLookupSource(env);
     };
 };
 
+Value *FunctionMemoryStats::apply(const vector<Value *> &,
+                                  Environment *env,
+                                  unordered_map<Symbol, Value *> *) const {
+    auto context = env->context;
+    auto stats = context->getStats();
+    auto result = context->newDictionaryValue();
+    result->set(L"掃除回数", context->newNumberValue(stats.collections));
+    result->set(L"小掃除回数", context->newNumberValue(stats.minorCollections));
+    result->set(L"合計停止時間", context->newFloatValue(stats.totalPauseMs));
+    result->set(L"最大停止時間", context->newFloatValue(stats.maxPauseMs));
+    auto histogram = context->newArrayValue(env);
+    result->set(L"停止分布", histogram);
+    for (auto count : stats.pauseHistogram) {
+        histogram->push(context->newNumberValue(count));
+    }
+    result->set(L"生存バイト", context->newNumberValue((long) stats.liveBytes));
+    result->set(L"ヒープバイト", context->newNumberValue((long) stats.heapBytes));
+    result->set(L"最大ヒープバイト", context->newNumberValue((long) stats.peakHeapBytes));
+    result->set(L"環境数", context->newNumberValue((long) stats.liveEnvironments));
+    auto byType = context->newDictionaryValue();
+    result->set(L"型別", byType);
+    for (size_t type = 0; type < ValueTypeCount; type++) {
+        byType->set(decodeUTF8(ValueTypeStrings[type]),
+                    context->newNumberValue((long) stats.liveValues[type]));
+    }
+    return result;
+}
+
 void initModule(Environment *env) {
     env->bind(L"足す", new FunctionSum());
     env->bind(L"引く", new FunctionDiff());
@@ -378,4 +404,5 @@ void initModule(Environment *env) {
     env->bind(L"ファイル読む", new FunctionReadFile());
     env->bind(L"評価", new FunctionEval());
     env->bind(L"エキステンション", new FunctionLoadExt());
+    env->bind(L"メモリ情報", new FunctionMemoryStats());
 }
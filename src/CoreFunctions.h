@@ -12,13 +12,20 @@ extern const wchar_t *corePinponStarter;
 class FunctionNewDictionary : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *kwargsIn) const override;
+                 unordered_map<Symbol, Value *> *kwargsIn) const override;
 };
 
 class FunctionForEach : public FunctionValue {
 public:
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *kwargsIn) const override;
+                 unordered_map<Symbol, Value *> *kwargsIn) const override;
+};
+
+// Returns the collector statistics of the calling Context as a 辞書.
+class FunctionMemoryStats : public FunctionValue {
+public:
+    Value *apply(const vector<Value *> &args, Environment *env,
+                 unordered_map<Symbol, Value *> *kwargsIn) const override;
 };
 
 #endif
\ No newline at end of file
@@ -3,27 +3,36 @@
 #include "CoreFunctions.h"
 #include "pathutils.h"
 #include "Logger.h"
+#include "VM.h"
+#include "Bytecode.h"
+#include "Optimizer.h"
 
-Value *Environment::eval(SyntaxNode *tree,
-                         const FunctionValue *tailContext) {
+Value *Environment::eval(SyntaxNode *tree, TailPosition position) {
+    if (context->usesBytecode()) {
+        return VM(context).run(context->compile(tree), this);
+    }
     context->collect(this);
     switch (tree->type) {
         case NodeType::CALL:
-            return eval_call(tree, tailContext);
+            return eval_call(tree, position);
         case NodeType::TERMINAL:
             return eval_terminal(tree);
         case NodeType::TEXT:
-            return eval_text(tree, tailContext);
+            return eval_text(tree, position);
         case NodeType::FUNC:
             return eval_function(tree);
         case NodeType::RETURN:
-            return eval_return(tree, tailContext);
+            return eval_return(tree, position);
         case NodeType::IMPORT:
             return eval_import(tree);
         case NodeType::EXTERNAL:
             return eval_nonlocal(tree);
         case NodeType::IF:
-            return eval_if(tree);
+            return eval_if(tree, position);
+        case NodeType::LOOP:
+            return eval_loop(tree, position);
+        case NodeType::RANGE_LOOP:
+            return eval_range_loop(tree, position);
         case NodeType::ASSIGN:
             return eval_assign(tree);
         case NodeType::ADD:
@@ -54,149 +63,84 @@ Value *Environment::eval(SyntaxNode *tree,
 }
 
 Value *Environment::eval_add(SyntaxNode *tree) {
-    auto lhs = eval(tree->children[0]);
-    context->tempRefIncrement(lhs);
-    auto rhs = eval(tree->children[1]);
-    context->tempRefDecrement(lhs);
-    if (lhs->type == ValueType::NUM_FLOAT && rhs->type == ValueType::NUM_FLOAT) {
-        return context->newFloatValue(
-                ((FloatValue *) lhs)->value + ((FloatValue *) rhs)->value
-        );
-    } else if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
-        return context->newNumberValue(
-                lhs->toNumberValue()->value + rhs->toNumberValue()->value);
-    } else if (lhs->type == ValueType::STRING && rhs->type == ValueType::STRING) {
-        return context->newStringValue(lhs->toStringValue()->value + rhs->toStringValue()->value);
-    } else if (lhs->type == ValueType::ARRAY && rhs->type == ValueType::ARRAY) {
-        auto result = context->newArrayValue(this);
-        auto a = ((ArrayValue *) lhs)->value;
-        auto b = ((ArrayValue *) rhs)->value;
-        result->value.insert(result->value.end(), a.begin(), a.end());
-        result->value.insert(result->value.end(), b.begin(), b.end());
-        return result;
-    }
-    return context->newNoneValue();
+    RootScope roots(context);
+    auto lhs = roots.push(eval(tree->children[0]));
+    return add(lhs, eval(tree->children[1]));
 }
 
 Value *Environment::eval_sub(SyntaxNode *tree) {
-    auto lhs = eval(tree->children[0]);
-    context->tempRefIncrement(lhs);
-    auto rhs = eval(tree->children[1]);
-    context->tempRefDecrement(lhs);
-    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
-        return context->newNumberValue(
-                lhs->toNumberValue()->value - rhs->toNumberValue()->value);
-    }
-    return context->newNoneValue();
+    RootScope roots(context);
+    auto lhs = roots.push(eval(tree->children[0]));
+    return subtract(lhs, eval(tree->children[1]));
 }
 
 Value *Environment::eval_mul(SyntaxNode *tree) {
-    auto lhs = eval(tree->children[0]);
-    context->tempRefIncrement(lhs);
-    auto rhs = eval(tree->children[1]);
-    context->tempRefDecrement(lhs);
-    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
-        return context->newNumberValue(
-                lhs->toNumberValue()->value * rhs->toNumberValue()->value);
-    }
-    return context->newNoneValue();
+    RootScope roots(context);
+    auto lhs = roots.push(eval(tree->children[0]));
+    return multiply(lhs, eval(tree->children[1]));
 }
 
 Value *Environment::eval_div(SyntaxNode *tree) {
-    auto lhs = eval(tree->children[0]);
-    context->tempRefIncrement(lhs);
-    auto rhs = eval(tree->children[1]);
-    context->tempRefDecrement(lhs);
-    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
-        return context->newNumberValue(
-                lhs->toNumberValue()->value / rhs->toNumberValue()->value);
-    }
-    return context->newNoneValue();
+    RootScope roots(context);
+    auto lhs = roots.push(eval(tree->children[0]));
+    return divide(lhs, eval(tree->children[1]));
 }
 
 Value *Environment::eval_equal(SyntaxNode *tree) {
-    auto lhs = eval(tree->children[0]);
-    context->tempRefIncrement(lhs);
-    auto rhs = eval(tree->children[1]);
-    context->tempRefDecrement(lhs);
-    return context->newNumberValue(lhs->equals(rhs) ? 1 : 0);
+    RootScope roots(context);
+    auto lhs = roots.push(eval(tree->children[0]));
+    return equal(lhs, eval(tree->children[1]));
 }
 
 Value *Environment::eval_not_equal(SyntaxNode *tree) {
-    auto lhs = eval(tree->children[0]);
-    context->tempRefIncrement(lhs);
-    auto rhs = eval(tree->children[1]);
-    context->tempRefDecrement(lhs);
-    return context->newNumberValue(lhs->equals(rhs) ? 0 : 1);
+    RootScope roots(context);
+    auto lhs = roots.push(eval(tree->children[0]));
+    return notEqual(lhs, eval(tree->children[1]));
 }
 
 Value *Environment::eval_gt(SyntaxNode *tree) {
-    auto lhs = eval(tree->children[0]);
-    context->tempRefIncrement(lhs);
-    auto rhs = eval(tree->children[1]);
-    context->tempRefDecrement(lhs);
-    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
-        return context->newNumberValue(lhs->toNumberValue()->value > rhs->toNumberValue()->value ? 1 : 0);
-    }
-    return context->newNoneValue();
+    RootScope roots(context);
+    auto lhs = roots.push(eval(tree->children[0]));
+    return greater(lhs, eval(tree->children[1]));
 }
 
 Value *Environment::eval_lt(SyntaxNode *tree) {
-    auto lhs = eval(tree->children[0]);
-    context->tempRefIncrement(lhs);
-    auto rhs = eval(tree->children[1]);
-    context->tempRefDecrement(lhs);
-    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
-        return context->newNumberValue(lhs->toNumberValue()->value < rhs->toNumberValue()->value ? 1 : 0);
-    }
-    return context->newNoneValue();
+    RootScope roots(context);
+    auto lhs = roots.push(eval(tree->children[0]));
+    return less(lhs, eval(tree->children[1]));
 }
 
 Value *Environment::eval_gte(SyntaxNode *tree) {
-    auto lhs = eval(tree->children[0]);
-    context->tempRefIncrement(lhs);
-    auto rhs = eval(tree->children[1]);
-    context->tempRefDecrement(lhs);
-    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
-        return context->newNumberValue(lhs->toNumberValue()->value >= rhs->toNumberValue()->value ? 1 : 0);
-    }
-    return context->newNoneValue();
+    RootScope roots(context);
+    auto lhs = roots.push(eval(tree->children[0]));
+    return greaterOrEqual(lhs, eval(tree->children[1]));
 }
 
 Value *Environment::eval_lte(SyntaxNode *tree) {
-    auto lhs = eval(tree->children[0]);
-    context->tempRefIncrement(lhs);
-    auto rhs = eval(tree->children[1]);
-    context->tempRefDecrement(lhs);
-    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
-        return context->newNumberValue(lhs->toNumberValue()->value <= rhs->toNumberValue()->value ? 1 : 0);
-    }
-    return context->newNoneValue();
+    RootScope roots(context);
+    auto lhs = roots.push(eval(tree->children[0]));
+    return lessOrEqual(lhs, eval(tree->children[1]));
 }
 
-Value *Environment::eval_call(SyntaxNode *tree, const FunctionValue *tailContext) {
-    Value *first = eval(tree->children[0]);
-    context->tempRefIncrement(first);
+Value *Environment::eval_call(SyntaxNode *tree, TailPosition position) {
+    RootScope roots(context);
+    Value *first = roots.push(eval(tree->children[0]));
     SyntaxNode *tail = tree->children[1];
 
-    Value *result = eval_tail(first, tail, tailContext);
-
-    context->tempRefDecrement(first);
-    return result;
+    return eval_tail(first, tail, position);
 }
 
-Value *Environment::eval_tail(Value *first, SyntaxNode *tail,
-                              const FunctionValue *tailContext) {
+Value *Environment::eval_tail(Value *first, SyntaxNode *tail, TailPosition position) {
     if (tail->type == NodeType::CALL_TAIL) {
-        return eval_calltail(first, tail, tailContext);
+        return eval_calltail(first, tail, position);
     } else if (tail->type == NodeType::GET) {
-        return eval_get(first, tail);
+        return eval_get(first, tail, position);
     } else if (tail->type == NodeType::GET_BIND) {
-        return eval_get_bind(first, tail);
+        return eval_get_bind(first, tail, position);
     } else if (tail->type == NodeType::SET) {
         return eval_set(first, tail);
     } else if (tail->type == NodeType::SUBSCRIPT) {
-        return eval_subscript(first, tail);
+        return eval_subscript(first, tail, position);
     } else if (tail->type == NodeType::SUBSCRIPT_SET) {
         return eval_subscript_set(first, tail);
     } else {
@@ -206,198 +150,113 @@ Value *Environment::eval_tail(Value *first, SyntaxNode *tail,
 
 
 Value *Environment::eval_calltail(Value *functionInput, SyntaxNode *tail,
-                                  const FunctionValue *tailContext) {
+                                  TailPosition position) {
     if (functionInput->type != ValueType::FUNC) {
         logger->log("実行エラー：関数型ではない物を呼べません。")->logEndl();
         return context->newNoneValue();
     }
     auto function = static_cast<FunctionValue *>(functionInput);
-    if (tail->children.size() == 2) {
-        tailContext = nullptr;
-    }
+    // Only the last step of a chain is in the chain's position.
+    TailPosition callPosition = tail->children.size() == 2 ? TailPosition::NONE : position;
 
+    // Arguments are kept on the root stack while the rest are evaluated,
+    // which also saves a tail call from building a vector of its own.
     SyntaxNode *args_tree = tail->children[0];
-    vector<Value *> args;
-    unordered_map<wstring, Value *> kwargsIn;
+    RootScope roots(context);
+    unordered_map<Symbol, Value *> kwargsIn;
     for (auto expression : args_tree->children) {
         if (expression->type == NodeType::KWARG) {
             auto *lhs = expression->children[0];
             auto *rhs = expression->children[1];
-            auto arg = eval(rhs);
-            kwargsIn[lhs->content.content] = arg;
-            context->tempRefIncrement(arg);
+            kwargsIn[lhs->content.symbol] = roots.push(eval(rhs));
         } else {
-            auto arg = eval(expression);
-            context->tempRefIncrement(arg);
-            args.push_back(arg);
+            roots.push(eval(expression));
         }
     }
-    if (function == tailContext) {
-        for (auto arg : args) {
-            context->tempRefDecrement(arg);
-        }
-        for (auto arg : kwargsIn) {
-            context->tempRefDecrement(arg.second);
-        }
-        auto result = new TailCallValue(args);
-        if (!kwargsIn.empty()) {
-            result->kwArgs = kwargsIn;
-            result->hasKwArgs = true;
+    // An error raised while evaluating the arguments skips the call.
+    if (context->completion.status == Completion::ERROR) {
+        return context->newNoneValue();
+    }
+    bool tailCall = (callPosition == TailPosition::LAST || callPosition == TailPosition::RETURNED) &&
+                    Context::tailCallable(function);
+    vector<Value *> args;
+    vector<Value *> &positional = tailCall ? context->completion.args : args;
+    positional.clear();
+    const Word *argument = roots.begin();
+    for (auto expression : args_tree->children) {
+        if (expression->type != NodeType::KWARG) {
+            positional.push_back(argument->asPointer());
         }
-        return result;
+        argument++;
     }
-    auto result = function->apply(
-            args, this, kwargsIn.empty() ? nullptr : &kwargsIn);
-    auto finalResult = result;
-    context->tempRefIncrement(result);
+    if (tailCall) {
+        context->completion.kwArgs.swap(kwargsIn);
+        return context->signalTailCall(function, callPosition);
+    }
+    auto result = roots.push(function->apply(
+            args, this, kwargsIn.empty() ? nullptr : &kwargsIn));
 
     if (tail->children.size() == 2) {
         auto nextTail = tail->children[1];
-        finalResult = eval_tail(result, nextTail);
-    }
-
-    for (auto arg : args) {
-        context->tempRefDecrement(arg);
-    }
-    for (const auto &kwarg : kwargsIn) {
-        context->tempRefDecrement(kwarg.second);
+        return eval_tail(result, nextTail, position);
     }
-    context->tempRefDecrement(result);
-    return finalResult;
+    return result;
 }
 
-Value *Environment::eval_get(Value *source, SyntaxNode *tree) {
-    wstring key = tree->children[0]->content.content;
-    DictionaryValue *lookupSource = source->getLookupSource(this);
-    if (lookupSource == nullptr) {
-        logger->log("エラー：「・」の左側はGET出来ない型。")->log(key)->logEndl();
-        return context->newNoneValue();
-    }
-    if (!lookupSource->has(key)) {
-        logger->log("エラー：辞書にキーは入っていない。")->log(key)->logEndl();
+Value *Environment::eval_get(Value *source, SyntaxNode *tree, TailPosition position) {
+    RootScope roots(context);
+    auto result = roots.push(getMember(source, tree->children[0]->content.symbol));
+    if (result == nullptr) {
         return context->newNoneValue();
     }
-    auto getResult = lookupSource->get(key);
-    context->tempRefIncrement(getResult);
-    auto result = getResult;
     if (tree->children.size() == 2) {
-        result = eval_tail(result, tree->children[1]);
+        result = eval_tail(result, tree->children[1], position);
     }
-    context->tempRefDecrement(getResult);
     return result;
 }
 
-Value *Environment::eval_get_bind(Value *source, SyntaxNode *tree) {
-    wstring key = tree->children[0]->content.content;
-    DictionaryValue *lookupSource = source->getLookupSource(this);
-    if (lookupSource == nullptr) {
-        cout << "実行エラー：波ダッシュの左側はGET出来ない型がある。" << encodeUTF8(key) << endl;
+Value *Environment::eval_get_bind(Value *source, SyntaxNode *tree, TailPosition position) {
+    RootScope roots(context);
+    auto result = roots.push(bindMember(source, tree->children[0]->content.symbol));
+    if (result == nullptr) {
         return context->newNoneValue();
     }
-    if (!lookupSource->has(key)) {
-        cout << "実行エラー：辞書にキーは入っていない。" << encodeUTF8(key) << endl;
-        return context->newNoneValue();
-    }
-    auto getResult = lookupSource->get(key);
-    if (getResult->type != ValueType::FUNC) {
-        cout << "実行エラー：波線の右側のタイプは関数ではありません。バインドはできません。" << endl;
-        return context->newNoneValue();
-    }
-    context->tempRefIncrement(getResult);
-    auto boundGetResult = context->newBoundFunctionValue(dynamic_cast<FunctionValue *>(getResult), source);
-    context->tempRefIncrement(boundGetResult);
-    Value *result = boundGetResult;
     if (tree->children.size() == 2) {
-        result = eval_tail(result, tree->children[1]);
+        result = eval_tail(result, tree->children[1], position);
     }
-    context->tempRefDecrement(boundGetResult);
-    context->tempRefDecrement(getResult);
     return result;
 }
 
-Value *Environment::eval_subscript(Value *source, SyntaxNode *tree) {
-    if (source->type == ValueType::DICT) {
-        auto sourceDictionary = (DictionaryValue *) source;
-        SyntaxNode *arg = tree->children[0];
-        wstring key = ((StringValue *) eval(arg))->value;
-        if (!sourceDictionary->has(key)) {
-            return context->newNoneValue();
-        }
-        auto result = sourceDictionary->get(key);
-        if (tree->children.size() == 2) {
-            context->tempRefIncrement(result);
-            result = eval_tail(result, tree->children[1]);
-            context->tempRefDecrement(result);
-        }
-        return result;
-    } else if (source->type == ValueType::ARRAY) {
-        auto sourceArray = (ArrayValue *) source;
-        SyntaxNode *arg = tree->children[0];
-        long index = ((NumberValue *) eval(arg))->value;
-        if (sourceArray->length() <= index) {
-            cout << "添字は配列の外　添字：" << index << "　長さ：" << sourceArray->length() << endl;
-            return context->newNoneValue();
-        }
-        auto result = sourceArray->getIndex(index);
-        if (tree->children.size() == 2) {
-            result = eval_tail(result, tree->children[1]);
-        }
-        return result;
-    } else if (source->type == ValueType::STRING) {
-        auto sourceString = (StringValue *) source;
-        SyntaxNode *arg = tree->children[0];
-        long index = ((NumberValue *) eval(arg))->value;
-        if ((long) sourceString->value.length() <= index) {
-            cout << "添字は文字列の外　添字：" << index << "　長さ：" << sourceString->value.length() << endl;
-            return context->newNoneValue();
-        }
-        Value *result = context->newStringValue(wstring(1, sourceString->value[index]));
-        if (tree->children.size() == 2) {
-            context->tempRefIncrement(result);
-            result = eval_tail(result, tree->children[1]);
-            context->tempRefDecrement(result);
-        }
-        return result;
+Value *Environment::eval_subscript(Value *source, SyntaxNode *tree, TailPosition position) {
+    RootScope roots(context);
+    auto result = roots.push(subscript(source, eval(tree->children[0])));
+    if (result == nullptr) {
+        return context->newNoneValue();
     }
-    return context->newNoneValue();
+    if (tree->children.size() == 2) {
+        result = eval_tail(result, tree->children[1], position);
+    }
+    return result;
 }
 
 Value *Environment::eval_subscript_set(Value *source, SyntaxNode *tree) {
-    if (source->type == ValueType::DICT) {
-        auto sourceDictionary = (DictionaryValue *) source;
-        SyntaxNode *arg = tree->children[0];
-        wstring key = ((StringValue *) eval(arg))->value;
-        auto rhs = eval(tree->children[1]);
-        sourceDictionary->set(key, rhs);
-    } else if (source->type == ValueType::ARRAY) {
-        auto sourceArray = (ArrayValue *) source;
-        SyntaxNode *arg = tree->children[0];
-        long index = ((NumberValue *) eval(arg))->value;
-        if (sourceArray->length() <= index) {
-            cout << "添字は配列の外　添字：" << index << "　長さ：" << sourceArray->length() << endl;
-            return context->newNoneValue();
-        }
-        auto rhs = eval(tree->children[1]);
-        sourceArray->set(index, rhs);
-    }
+    RootScope roots(context);
+    auto key = roots.push(eval(tree->children[0]));
+    setSubscript(source, key, eval(tree->children[1]));
     return context->newNoneValue();
 }
 
 Value *Environment::eval_set(Value *source, SyntaxNode *tree) {
-    if (source->type != ValueType::DICT) {
-        cout << "実行エラー：「・ ＝」のときに「＝」の左側はSET出来ない型です。" << endl;
-        return context->newNoneValue();
-    }
-    DictionaryValue *sourceDict = static_cast<DictionaryValue*>(source);
-    wstring key = tree->children[0]->content.content;
-    auto rhs = eval(tree->children[1]);
-    sourceDict->set(key, rhs);
+    setMember(source, tree->children[0]->content.symbol, eval(tree->children[1]));
     return context->newNoneValue();
 }
 
 Value *Environment::eval_terminal(SyntaxNode *tree) {
+    if (tree->constant) {
+        return tree->constant;
+    }
     if (tree->content.type == TokenType::SYMBOL) {
-        wstring name = tree->content.content;
+        Symbol name = tree->content.symbol;
         auto result = lookup(name);
         if (!result) {
             return context->newNoneValue();
@@ -419,13 +278,15 @@ Value *Environment::eval_terminal(SyntaxNode *tree) {
     return context->newNoneValue();
 }
 
-Value *Environment::eval_text(SyntaxNode *tree,
-                              const FunctionValue *tailContext) {
-    for (auto statement : tree->children) {
-        Value *statementReturnValue = eval(statement, tailContext);
-        if (statementReturnValue->type == ValueType::RETURN ||
-            statementReturnValue->type == ValueType::TAIL_CALL) {
+Value *Environment::eval_text(SyntaxNode *tree, TailPosition position) {
+    for (size_t i = 0; i < tree->children.size(); i++) {
+        bool last = i == tree->children.size() - 1;
+        Value *statementReturnValue = eval(
+                tree->children[i], position == TailPosition::LAST && !last ? TailPosition::BODY : position);
+        if (statementReturnValue == Context::unwindSignal()) {
             return statementReturnValue;
+        } else if (context->completion.status == Completion::ERROR) {
+            return Context::unwindSignal();
         } else if (statementReturnValue != nullptr && // TODO: always true
                    statementReturnValue->type != ValueType::NONE) {
         }
@@ -434,26 +295,26 @@ Value *Environment::eval_text(SyntaxNode *tree,
 }
 
 Value *Environment::eval_function(SyntaxNode *tree) {
-    std::vector<wstring> params;
-    std::unordered_map<wstring, Value *> paramsWithDefault;
+    RootScope roots(context);
+    std::vector<Symbol> params;
+    std::unordered_map<Symbol, Value *> paramsWithDefault;
     bool hasKwParam = false;
     bool hasVarParam = false;
-    wstring kwParamName;
-    wstring varParamName;
+    Symbol kwParamName;
+    Symbol varParamName;
     for (auto param : tree->children[1]->children) {
         if (param->type == NodeType::TERMINAL) {
-            params.push_back(param->content.content);
+            params.push_back(param->content.symbol);
         } else if (param->type == NodeType::VARKWPARAM) {
             hasKwParam = true;
-            kwParamName = param->children[0]->content.content;
+            kwParamName = param->children[0]->content.symbol;
         } else if (param->type == NodeType::VARPARAM) {
             hasVarParam = true;
-            varParamName = param->children[0]->content.content;
+            varParamName = param->children[0]->content.symbol;
         } else if (param->type == NodeType::DEFAULTPARAM) {
 //            wcout << L"DEFAULTPARAM:" << param->children[0]->content.content << endl;
-            auto defaultValue = eval(param->children[1], nullptr);
-            context->tempRefIncrement(defaultValue);
-            paramsWithDefault[param->children[0]->content.content] = defaultValue;
+            auto defaultValue = roots.push(eval(param->children[1]));
+            paramsWithDefault[param->children[0]->content.symbol] = defaultValue;
         }
     }
     auto body = tree->children[2];
@@ -467,11 +328,13 @@ Value *Environment::eval_function(SyntaxNode *tree) {
     }
     auto nameNode = tree->children[0];
     if (nameNode->type == NodeType::TERMINAL) {
-        wstring name = nameNode->content.content;
+        Symbol name = nameNode->content.symbol;
+        forgetCounter(name);
         bindings[name] = function;
+        writeBarrier(function);
     } else {
-        auto name1 = nameNode->children[0]->content.content;
-        auto name2 = nameNode->children[1]->content.content;
+        auto name1 = nameNode->children[0]->content.symbol;
+        auto name2 = nameNode->children[1]->content.symbol;
         Value *name1value = lookup(name1);
         if (name1value->type != ValueType::DICT) {
             cout << "error not of type dict" << endl;
@@ -483,65 +346,82 @@ Value *Environment::eval_function(SyntaxNode *tree) {
     return Context::newNoneValue();
 }
 
-Value *Environment::eval_return(SyntaxNode *tree,
-                                const FunctionValue *tailContext) {
-    auto result = eval(tree->children[0], tailContext);
-    if (result->type == ValueType::TAIL_CALL) {
+Value *Environment::eval_return(SyntaxNode *tree, TailPosition position) {
+    auto result = eval(tree->children[0],
+                       position == TailPosition::NONE ? TailPosition::NONE : TailPosition::RETURNED);
+    if (result == Context::unwindSignal()) {
         return result;
     }
-    return new ReturnValue(result);
+    return context->signalReturn(result);
 }
 
 Value *Environment::eval_import(SyntaxNode *tree) {
-    auto path = encodeUTF8(lookup(L"FILE")->toStringValue()->value);
-    auto dir = getDirectoryForPath(path);
-
-    auto relativePath = string();
-    wstring dirToken;
+    vector<wstring> path;
     for (auto child : tree->children) {
-        dirToken = child->content.content;
-        relativePath += string("/") + encodeUTF8(dirToken);
+        path.push_back(child->content.content);
     }
-    relativePath += string(".pin");
-
-    string tryPath = dir + relativePath;
-    ConsoleLogger logger;
-    logger.log(L"importing from:「")->log(path)
-            ->log(L"」 path:「")->log(tryPath)
-            ->log(L"」 as:「")->log(dirToken)->log("」")->logEndl();
-    auto fileInputSource = filesystem->getInputSourceForFilename(tryPath);
-    if (!fileInputSource->good()) {
-        logger.log("ERROR: could not import")->logEndl();
-        return context->newNoneValue();
-    }
-    InputSourceTokenizer tokenizer(fileInputSource.get());
-    Parser parser(&tokenizer, &logger);
-    auto parsedTree = parser.run();
-    auto importEnv = newChildEnvironment();
-    importEnv->bind(L"FILE", context->newStringValue(decodeUTF8(tryPath)));
-    importEnv->eval(parsedTree);
-    auto module = importEnv->toNewDictionaryValue();
-    bind(dirToken, module);
+    importModule(path);
     return context->newNoneValue();
 }
 
 Value *Environment::eval_nonlocal(SyntaxNode *tree) {
     for (auto &child : tree->children) {
-        nonlocals.insert(child->content.content);
+        nonlocals.insert(child->content.symbol);
     }
     return context->newNoneValue();
 }
 
-Value *Environment::eval_if(SyntaxNode *tree) {
+Value *Environment::eval_if(SyntaxNode *tree, TailPosition position) {
     for (size_t i = 0; i < tree->children.size(); i += 2) {
         if (i == tree->children.size() - 1) {
-            return eval(tree->children[i]);
+            return eval(tree->children[i], position);
         }
         SyntaxNode *condition = tree->children[i];
         SyntaxNode *body = tree->children[i + 1];
         Value *condValue = eval(condition);
         if (condValue->isTruthy()) {
-            auto result = eval(body);
+            auto result = eval(body, position);
+            return result;
+        }
+    }
+    return context->newNoneValue();
+}
+
+// Loops run in the current environment. Their bodies are never in tail
+// position, since the loop may go on after them.
+Value *Environment::eval_loop(SyntaxNode *tree, TailPosition position) {
+    TailPosition bodyPosition = position == TailPosition::NONE ? TailPosition::NONE : TailPosition::BODY;
+    while (eval(tree->children[0])->isTruthy()) {
+        Value *result = eval(tree->children[1], bodyPosition);
+        if (result == Context::unwindSignal()) {
+            return result;
+        }
+    }
+    return context->newNoneValue();
+}
+
+Value *Environment::eval_range_loop(SyntaxNode *tree, TailPosition position) {
+    TailPosition bodyPosition = position == TailPosition::NONE ? TailPosition::NONE : TailPosition::BODY;
+    Symbol name = tree->children[0]->content.symbol;
+    RootScope roots(context);
+    Value *from = roots.push(eval(tree->children[1]));
+    Value *to = eval(tree->children[2]);
+    if (from->type != ValueType::NUM || to->type != ValueType::NUM) {
+        logger->log("実行エラー：繰り返す文の範囲は整数が必要です。")->logEndl();
+        return context->newNoneValue();
+    }
+    long start = from->toNumberValue()->value;
+    long end = to->toNumberValue()->value;
+    bool counted = !frame && nonlocals.find(name) == nonlocals.end() &&
+                   Word::fitsInt(start) && Word::fitsInt(end);
+    for (long i = start; i < end; i++) {
+        if (counted) {
+            setCounter(name, i);
+        } else {
+            bind(name, context->newNumberValue(i));
+        }
+        Value *result = eval(tree->children[3], bodyPosition);
+        if (result == Context::unwindSignal()) {
             return result;
         }
     }
@@ -549,18 +429,226 @@ Value *Environment::eval_if(SyntaxNode *tree) {
 }
 
 Value *Environment::eval_assign(SyntaxNode *tree) {
-    wstring lhs = tree->children[0]->content.content;
+    Symbol lhs = tree->children[0]->content.symbol;
     bind(lhs, eval(tree->children[1]));
     return context->newNoneValue();
 }
 
 Value *Environment::eval_assert(SyntaxNode *tree) {
-    auto rhs = eval(tree->children[0]);
-    if (!rhs->isTruthy()) {
-        ConsoleLogger().log("確認エラー終了：")->logLong(tree->content.line)->logLn("行目");
+    return checkAssertion(eval(tree->children[0]), tree->content.line);
+}
+
+Value *Environment::add(Value *lhs, Value *rhs) {
+    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
+        return context->newNumberValue(
+                lhs->toNumberValue()->value + rhs->toNumberValue()->value);
+    } else if (isNumeric(lhs) && isNumeric(rhs)) {
+        return context->newFloatValue(floatValueOf(lhs) + floatValueOf(rhs));
+    } else if (lhs->type == ValueType::STRING && rhs->type == ValueType::STRING) {
+        return context->newStringValue(lhs->toStringValue()->value + rhs->toStringValue()->value);
+    } else if (lhs->type == ValueType::ARRAY && rhs->type == ValueType::ARRAY) {
+        auto result = context->newArrayValue(this);
+        const auto &a = ((ArrayValue *) lhs)->value;
+        const auto &b = ((ArrayValue *) rhs)->value;
+        result->value.reserve(a.size() + b.size());
+        result->value.append(a.begin(), a.end());
+        result->value.append(b.begin(), b.end());
+        result->recordGrowth(0);
+        return result;
+    }
+    return context->newNoneValue();
+}
+
+Value *Environment::subtract(Value *lhs, Value *rhs) {
+    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
+        return context->newNumberValue(
+                lhs->toNumberValue()->value - rhs->toNumberValue()->value);
+    } else if (isNumeric(lhs) && isNumeric(rhs)) {
+        return context->newFloatValue(floatValueOf(lhs) - floatValueOf(rhs));
+    }
+    return context->newNoneValue();
+}
+
+Value *Environment::multiply(Value *lhs, Value *rhs) {
+    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
+        return context->newNumberValue(
+                lhs->toNumberValue()->value * rhs->toNumberValue()->value);
+    } else if (isNumeric(lhs) && isNumeric(rhs)) {
+        return context->newFloatValue(floatValueOf(lhs) * floatValueOf(rhs));
+    }
+    return context->newNoneValue();
+}
+
+Value *Environment::divide(Value *lhs, Value *rhs) {
+    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
+        return context->newNumberValue(
+                lhs->toNumberValue()->value / rhs->toNumberValue()->value);
+    } else if (isNumeric(lhs) && isNumeric(rhs)) {
+        return context->newFloatValue(floatValueOf(lhs) / floatValueOf(rhs));
+    }
+    return context->newNoneValue();
+}
+
+Value *Environment::equal(Value *lhs, Value *rhs) {
+    return context->newNumberValue(valuesEqual(lhs, rhs) ? 1 : 0);
+}
+
+Value *Environment::notEqual(Value *lhs, Value *rhs) {
+    return context->newNumberValue(valuesEqual(lhs, rhs) ? 0 : 1);
+}
+
+Value *Environment::greater(Value *lhs, Value *rhs) {
+    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
+        return context->newNumberValue(lhs->toNumberValue()->value > rhs->toNumberValue()->value ? 1 : 0);
+    } else if (isNumeric(lhs) && isNumeric(rhs)) {
+        return context->newNumberValue(floatValueOf(lhs) > floatValueOf(rhs) ? 1 : 0);
+    }
+    return context->newNoneValue();
+}
+
+Value *Environment::less(Value *lhs, Value *rhs) {
+    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
+        return context->newNumberValue(lhs->toNumberValue()->value < rhs->toNumberValue()->value ? 1 : 0);
+    } else if (isNumeric(lhs) && isNumeric(rhs)) {
+        return context->newNumberValue(floatValueOf(lhs) < floatValueOf(rhs) ? 1 : 0);
+    }
+    return context->newNoneValue();
+}
+
+Value *Environment::greaterOrEqual(Value *lhs, Value *rhs) {
+    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
+        return context->newNumberValue(lhs->toNumberValue()->value >= rhs->toNumberValue()->value ? 1 : 0);
+    } else if (isNumeric(lhs) && isNumeric(rhs)) {
+        return context->newNumberValue(floatValueOf(lhs) >= floatValueOf(rhs) ? 1 : 0);
+    }
+    return context->newNoneValue();
+}
+
+Value *Environment::lessOrEqual(Value *lhs, Value *rhs) {
+    if (lhs->type == ValueType::NUM && rhs->type == ValueType::NUM) {
+        return context->newNumberValue(lhs->toNumberValue()->value <= rhs->toNumberValue()->value ? 1 : 0);
+    } else if (isNumeric(lhs) && isNumeric(rhs)) {
+        return context->newNumberValue(floatValueOf(lhs) <= floatValueOf(rhs) ? 1 : 0);
+    }
+    return context->newNoneValue();
+}
+
+Value *Environment::getMember(Value *source, Symbol key, PropertyCache *cache) {
+    DictionaryValue *lookupSource = source->getLookupSource(this);
+    if (lookupSource == nullptr) {
+        logger->log("エラー：「・」の左側はGET出来ない型。")->log(key.name())->logEndl();
+        return nullptr;
+    }
+    auto result = cache ? lookupSource->get(key, *cache) : lookupSource->get(key);
+    if (result == nullptr) {
+        logger->log("エラー：辞書にキーは入っていない。")->log(key.name())->logEndl();
+    }
+    return result;
+}
+
+Value *Environment::bindMember(Value *source, Symbol key, PropertyCache *cache) {
+    DictionaryValue *lookupSource = source->getLookupSource(this);
+    if (lookupSource == nullptr) {
+        cout << "実行エラー：波ダッシュの左側はGET出来ない型がある。" << encodeUTF8(key.name()) << endl;
+        return nullptr;
+    }
+    auto getResult = cache ? lookupSource->get(key, *cache) : lookupSource->get(key);
+    if (getResult == nullptr) {
+        cout << "実行エラー：辞書にキーは入っていない。" << encodeUTF8(key.name()) << endl;
+        return nullptr;
+    }
+    if (getResult->type != ValueType::FUNC) {
+        cout << "実行エラー：波線の右側のタイプは関数ではありません。バインドはできません。" << endl;
+        return nullptr;
+    }
+    return context->newBoundFunctionValue(static_cast<FunctionValue *>(getResult), source);
+}
+
+Value *Environment::subscript(Value *source, Value *key) {
+    if (source->type == ValueType::DICT) {
+        auto sourceDictionary = (DictionaryValue *) source;
+        return sourceDictionary->getEntry(((StringValue *) key)->value);
+    } else if (source->type == ValueType::ARRAY) {
+        auto sourceArray = (ArrayValue *) source;
+        long index = ((NumberValue *) key)->value;
+        if (sourceArray->length() <= index) {
+            cout << "添字は配列の外　添字：" << index << "　長さ：" << sourceArray->length() << endl;
+            return nullptr;
+        }
+        return sourceArray->getIndex(index);
+    } else if (source->type == ValueType::STRING) {
+        auto sourceString = (StringValue *) source;
+        long index = ((NumberValue *) key)->value;
+        if ((long) sourceString->value.length() <= index) {
+            cout << "添字は文字列の外　添字：" << index << "　長さ：" << sourceString->value.length() << endl;
+            return nullptr;
+        }
+        return context->newCharacterValue(sourceString->value[index]);
+    }
+    return nullptr;
+}
+
+void Environment::setMember(Value *source, Symbol key, Value *value) {
+    if (source->type != ValueType::DICT) {
+        cout << "実行エラー：「・ ＝」のときに「＝」の左側はSET出来ない型です。" << endl;
+        return;
+    }
+    static_cast<DictionaryValue *>(source)->set(key, value);
+}
+
+void Environment::setSubscript(Value *source, Value *key, Value *value) {
+    if (source->type == ValueType::DICT) {
+        ((DictionaryValue *) source)->setEntry(((StringValue *) key)->value, value);
+    } else if (source->type == ValueType::ARRAY) {
+        auto sourceArray = (ArrayValue *) source;
+        long index = ((NumberValue *) key)->value;
+        if (sourceArray->length() <= index) {
+            cout << "添字は配列の外　添字：" << index << "　長さ：" << sourceArray->length() << endl;
+            return;
+        }
+        sourceArray->set(index, value);
+    }
+}
+
+void Environment::importModule(const vector<wstring> &modulePath) {
+    auto path = lookup(L"FILE")->toStringValue()->value.toUTF8();
+    auto dir = getDirectoryForPath(path);
+
+    auto relativePath = string();
+    wstring dirToken;
+    for (auto &token : modulePath) {
+        dirToken = token;
+        relativePath += string("/") + encodeUTF8(dirToken);
+    }
+    relativePath += string(".pin");
+
+    string tryPath = dir + relativePath;
+    ConsoleLogger logger;
+    logger.log(L"importing from:「")->log(path)
+            ->log(L"」 path:「")->log(tryPath)
+            ->log(L"」 as:「")->log(dirToken)->log("」")->logEndl();
+    auto fileInputSource = filesystem->getInputSourceForFilename(tryPath);
+    if (!fileInputSource->good()) {
+        logger.log("ERROR: could not import")->logEndl();
+        return;
+    }
+    InputSourceTokenizer tokenizer(fileInputSource.get());
+    Parser parser(&tokenizer, &logger);
+    auto parsedTree = parser.run();
+    Optimizer(context).optimize(parsedTree);
+    auto importEnv = newChildEnvironment();
+    importEnv->bind(L"FILE", context->newStringValue(decodeUTF8(tryPath)));
+    context->completedValue(importEnv->eval(parsedTree));
+    auto module = importEnv->toNewDictionaryValue();
+    bind(dirToken, module);
+}
+
+Value *Environment::checkAssertion(Value *value, long line) {
+    if (!value->isTruthy()) {
+        ConsoleLogger().log("確認エラー終了：")->logLong(line)->logLn("行目");
         if (exitHandler != nullptr) {
             exitHandler->handleExit();
-            return new ReturnValue(context->newNumberValue(1));
+            return context->signalReturn(context->newNumberValue(1));
         } else {
             ConsoleLogger().log("exit ")->logLn("now");
             exit(1);
@@ -569,27 +657,69 @@ Value *Environment::eval_assert(SyntaxNode *tree) {
     return Context::newNoneValue();
 }
 
-Value *Environment::lookup(const wstring &name) {
-    if (bindings.count(name)) {
-        return bindings[name];
+Value *Environment::lookup(Symbol name) {
+    if (frame) {
+        auto slot = slotFor(name);
+        if (slot && !slot->isNull()) {
+            return context->box(*slot);
+        }
+    }
+    if (auto counter = counterFor(name)) {
+        return context->box(*counter);
+    }
+    auto binding = bindings.find(name);
+    if (binding != bindings.end()) {
+        return binding->second;
     }
     if (parent) {
         return parent->lookup(name);
     }
-    ConsoleLogger().log("lookup failure for '")->log(name)->log("'")->logEndl();
+    ConsoleLogger().log("lookup failure for '")->log(name.name())->log("'")->logEndl();
     return context->newNoneValue();
 }
 
-void Environment::bind(const wstring &name, Value *value, bool recursive) {
-    if ((recursive && bindings.find(name) == bindings.end()) || (nonlocals.find(name) != nonlocals.end())) {
+void Environment::bind(Symbol name, Value *value, bool recursive) {
+    Word *slot = frame ? slotFor(name) : nullptr;
+    bool bound = slot ? !slot->isNull() : counterFor(name) || bindings.find(name) != bindings.end();
+    if ((recursive && !bound) || (nonlocals.find(name) != nonlocals.end())) {
         if (parent) {
             parent->bind(name, value, true);
         } else {
-            ConsoleLogger().log("reached top stack frame for nonlocal '")->log(name)->log("'")->logEndl();
+            ConsoleLogger().log("reached top stack frame for nonlocal '")->log(name.name())->log("'")->logEndl();
         }
+    } else if (slot) {
+        setSlot(slot - slots.data(), value);
     } else {
+        forgetCounter(name);
         bindings[name] = value;
+        writeBarrier(value);
+    }
+}
+
+void Environment::setCounter(Symbol name, long value) {
+    if (auto counter = counterFor(name)) {
+        *counter = Word::fromInt(value);
+        return;
+    }
+    bindings.erase(name);
+    counters.emplace_back(name, Word::fromInt(value));
+}
+
+void Environment::enterFrame(const shared_ptr<const Code> &code) {
+    frame = code;
+    slots.assign(code->slotNames.size(), Word());
+}
+
+Word *Environment::slotFor(Symbol name) {
+    auto index = frame->slotIndex.find(name);
+    if (index == frame->slotIndex.end()) {
+        return nullptr;
     }
+    return &slots[index->second];
+}
+
+void Environment::rememberSelf() {
+    context->remember(this);
 }
 
 Environment *Environment::newChildEnvironment() {
@@ -611,5 +741,20 @@ DictionaryValue *Environment::toNewDictionaryValue() {
     for (const auto &binding : bindings) {
         result->set(binding.first, binding.second);
     }
+    for (const auto &counter : counters) {
+        result->set(counter.first, context->box(counter.second));
+    }
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (!slots[i].isNull()) {
+            result->set(frame->slotNames[i], context->box(slots[i]));
+        }
+    }
     return result;
 }
+
+size_t Environment::memorySize() const {
+    return sizeof(Environment) +
+           bindings.size() * (sizeof(pair<const Symbol, Value *>) + 2 * sizeof(void *)) +
+           bindings.bucket_count() * sizeof(void *) + slots.capacity() * sizeof(Word) +
+           counters.capacity() * sizeof(pair<Symbol, Word>);
+}
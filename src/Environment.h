@@ -9,20 +9,21 @@
 
 class Context;
 class ExitHandler;
+class Code;
 
 class Environment {
-    Value *eval_call(SyntaxNode *node, const FunctionValue *tailContext = nullptr);
+    Value *eval_call(SyntaxNode *node, TailPosition position = TailPosition::NONE);
 
-    Value *eval_tail(Value *first, SyntaxNode *node, const FunctionValue *tailContext = nullptr);
+    Value *eval_tail(Value *first, SyntaxNode *node, TailPosition position = TailPosition::NONE);
 
     Value *eval_calltail(Value *function, SyntaxNode *tail,
-                         const FunctionValue *tailContext = nullptr);
+                         TailPosition position = TailPosition::NONE);
 
-    Value *eval_get(Value *source, SyntaxNode *tree);
+    Value *eval_get(Value *source, SyntaxNode *tree, TailPosition position = TailPosition::NONE);
 
-    Value *eval_get_bind(Value *source, SyntaxNode *tree);
+    Value *eval_get_bind(Value *source, SyntaxNode *tree, TailPosition position = TailPosition::NONE);
 
-    Value *eval_subscript(Value *source, SyntaxNode *tree);
+    Value *eval_subscript(Value *source, SyntaxNode *tree, TailPosition position = TailPosition::NONE);
 
     Value *eval_subscript_set(Value *source, SyntaxNode *tree);
 
@@ -30,17 +31,21 @@ class Environment {
 
     Value *eval_terminal(SyntaxNode *node);
 
-    Value *eval_text(SyntaxNode *node, const FunctionValue *tailContext = nullptr);
+    Value *eval_text(SyntaxNode *node, TailPosition position = TailPosition::NONE);
 
     Value *eval_function(SyntaxNode *node);
 
-    Value *eval_return(SyntaxNode *node, const FunctionValue *tailContext = nullptr);
+    Value *eval_return(SyntaxNode *node, TailPosition position = TailPosition::NONE);
 
     Value *eval_import(SyntaxNode *node);
 
     Value *eval_nonlocal(SyntaxNode *node);
 
-    Value *eval_if(SyntaxNode *node);
+    Value *eval_if(SyntaxNode *node, TailPosition position = TailPosition::NONE);
+
+    Value *eval_loop(SyntaxNode *node, TailPosition position = TailPosition::NONE);
+
+    Value *eval_range_loop(SyntaxNode *node, TailPosition position = TailPosition::NONE);
 
     Value *eval_assign(SyntaxNode *node);
 
@@ -85,25 +90,127 @@ public:
     Environment *parent = nullptr;
     Environment *caller = nullptr;
     Context *context;
-    unordered_map<wstring, Value *> bindings;
-    unordered_set<wstring> nonlocals;
+    unordered_map<Symbol, Value *> bindings;
+    unordered_set<Symbol> nonlocals;
+    // Frames of compiled function bodies keep the names the compiler
+    // resolved in `slots`, laid out by `frame`; a null slot is unbound.
+    shared_ptr<const Code> frame;
+    vector<Word> slots;
+    // Counters of 繰り返す loops, kept as integer words and updated in place
+    // so that counting neither allocates nor goes through `bindings`. A name
+    // is in at most one of `counters` and `bindings`.
+    vector<pair<Symbol, Word>> counters;
     Filesystem *filesystem;
     PinponLogger *logger;
     ExitHandler *exitHandler = nullptr;
+    // GC state, see Context.
+    uint32_t mark = 0;
+    bool young = false;
+    bool remembered = false;
+    bool managed = false;
+
+    Value *lookup(Symbol name);
+
+    void bind(Symbol name, Value *value, bool recursive=false);
+
+    // Must be called after storing a reference to `value` in bindings.
+    void writeBarrier(Value *value) {
+        if (value->young && !young && !remembered) {
+            rememberSelf();
+        }
+    }
+
+    void rememberSelf();
+
+    void enterFrame(const shared_ptr<const Code> &code);
+
+    Word *slotFor(Symbol name);
+
+    Word *counterFor(Symbol name) {
+        for (auto &counter : counters) {
+            if (counter.first == name) {
+                return &counter.second;
+            }
+        }
+        return nullptr;
+    }
+
+    void setCounter(Symbol name, long value);
+
+    void forgetCounter(Symbol name) {
+        for (auto counter = counters.begin(); counter != counters.end(); ++counter) {
+            if (counter->first == name) {
+                counters.erase(counter);
+                return;
+            }
+        }
+    }
+
+    void setSlot(size_t slot, Word value) {
+        slots[slot] = value;
+        if (value.isPointer()) {
+            writeBarrier(value.asPointer());
+        }
+    }
+
+    void setSlot(size_t slot, Value *value) {
+        setSlot(slot, Word::of(value));
+    }
+
+    Value *eval(SyntaxNode *node, TailPosition position = TailPosition::NONE);
+
+    // Operations shared by the tree walker and the bytecode VM.
+    Value *add(Value *lhs, Value *rhs);
+
+    Value *subtract(Value *lhs, Value *rhs);
+
+    Value *multiply(Value *lhs, Value *rhs);
+
+    Value *divide(Value *lhs, Value *rhs);
+
+    Value *equal(Value *lhs, Value *rhs);
 
-    Value *lookup(const wstring &name);
+    Value *notEqual(Value *lhs, Value *rhs);
 
-    void bind(const wstring &name, Value *value, bool recursive=false);
+    Value *greater(Value *lhs, Value *rhs);
 
-    Value *eval(SyntaxNode *node, const FunctionValue *tailContext = nullptr);
+    Value *less(Value *lhs, Value *rhs);
+
+    Value *greaterOrEqual(Value *lhs, Value *rhs);
+
+    Value *lessOrEqual(Value *lhs, Value *rhs);
+
+    // Member and subscript reads return nullptr when the lookup fails, which
+    // ends the rest of the call chain. Compiled code passes the inline cache
+    // of the access site.
+    Value *getMember(Value *source, Symbol key, PropertyCache *cache = nullptr);
+
+    Value *bindMember(Value *source, Symbol key, PropertyCache *cache = nullptr);
+
+    Value *subscript(Value *source, Value *key);
+
+    void setMember(Value *source, Symbol key, Value *value);
+
+    void setSubscript(Value *source, Value *key, Value *value);
+
+    void importModule(const vector<wstring> &modulePath);
+
+    // Signals a return of 1 when the assertion failed and an exit handler
+    // is installed, returns None otherwise.
+    Value *checkAssertion(Value *value, long line);
 
     Environment *newChildEnvironment();
 
     void tailReset() {
         bindings.clear();
+        counters.clear();
+        slots.assign(slots.size(), Word());
     }
 
     DictionaryValue *toNewDictionaryValue();
+
+    // Approximate heap footprint, used for collection budgeting.
+    size_t memorySize() const;
 };
 
 class ExitHandler {
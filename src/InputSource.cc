@@ -43,3 +43,63 @@ wchar_t StringInputSource::peekChar() {
 bool StringInputSource::eof() {
     return finished;
 }
+
+wchar_t UTF8InputSource::decode(size_t *length) const {
+    auto lead = (unsigned char) *position;
+    size_t available = end - position;
+    size_t count;
+    wchar_t result;
+    if (lead < 0x80) {
+        *length = 1;
+        return lead;
+    } else if ((lead & 0xE0) == 0xC0) {
+        count = 2;
+        result = lead & 0x1F;
+    } else if ((lead & 0xF0) == 0xE0) {
+        count = 3;
+        result = lead & 0x0F;
+    } else if ((lead & 0xF8) == 0xF0) {
+        count = 4;
+        result = lead & 0x07;
+    } else {
+        *length = 1;
+        return 0xFFFD;
+    }
+    if (count > available) {
+        *length = 1;
+        return 0xFFFD;
+    }
+    for (size_t i = 1; i < count; i++) {
+        auto next = (unsigned char) position[i];
+        if ((next & 0xC0) != 0x80) {
+            *length = i;
+            return 0xFFFD;
+        }
+        result = (result << 6) | (next & 0x3F);
+    }
+    *length = count;
+    return result;
+}
+
+wchar_t UTF8InputSource::getChar() {
+    if (position == end) {
+        finished = true;
+        return L'\0';
+    }
+    size_t length;
+    wchar_t result = decode(&length);
+    position += length;
+    return result;
+}
+
+wchar_t UTF8InputSource::peekChar() {
+    if (position == end) {
+        return L'\0';
+    }
+    size_t length;
+    return decode(&length);
+}
+
+bool UTF8InputSource::eof() {
+    return finished;
+}
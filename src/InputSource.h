@@ -2,6 +2,7 @@
 #define INPUT_SOURCE_H
 
 #include <fstream>
+#include <string>
 
 using namespace std;
 
@@ -50,4 +51,27 @@ public:
     bool eof() override;
 };
 
+// Reads characters straight from UTF-8 text, such as a websocket payload,
+// without first decoding all of it to a wstring. Malformed bytes read as
+// U+FFFD. `source` must outlive this object.
+class UTF8InputSource : public InputSource {
+    const char *position;
+    const char *end;
+    bool finished;
+
+    // The character at `position` and its length in bytes.
+    wchar_t decode(size_t *length) const;
+public:
+    explicit UTF8InputSource(const string &source)
+            : position(source.data()), end(source.data() + source.size()), finished(false) {};
+
+    ~UTF8InputSource() override = default;
+
+    wchar_t getChar() override;
+
+    wchar_t peekChar() override;
+
+    bool eof() override;
+};
+
 #endif
\ No newline at end of file
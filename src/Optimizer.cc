@@ -0,0 +1,177 @@
+#include <climits>
+
+#include "Optimizer.h"
+
+void Optimizer::optimize(SyntaxNode *tree) {
+    fold(tree);
+}
+
+void Optimizer::fold(SyntaxNode *node) {
+    for (auto child : node->children) {
+        fold(child);
+    }
+    switch (node->type) {
+        case NodeType::TERMINAL:
+            if (node->constant == nullptr) {
+                const Token &token = node->content;
+                if (token.type == TokenType::NUMBER) {
+                    node->constant = context->newNumberValue(token.number);
+                } else if (token.type == TokenType::NUMBER_FLOAT) {
+                    node->constant = context->newFloatValue(token.numberFloat);
+                } else if (token.type == TokenType::STRING) {
+                    node->constant = context->newStringValue(token.content);
+                } else {
+                    return;
+                }
+                node->constant->refs++;
+            }
+            break;
+        case NodeType::ADD:
+        case NodeType::SUB:
+        case NodeType::MUL:
+        case NodeType::DIV:
+        case NodeType::EQUAL:
+        case NodeType::NEQ:
+        case NodeType::GT:
+        case NodeType::LT:
+        case NodeType::GTE:
+        case NodeType::LTE: {
+            if (node->children.size() != 2) {
+                break;
+            }
+            Value *lhs = node->children[0]->constant;
+            Value *rhs = node->children[1]->constant;
+            if (lhs && rhs) {
+                if (auto result = evaluate(node->type, lhs, rhs)) {
+                    makeLiteral(node, result);
+                }
+            }
+            break;
+        }
+        case NodeType::IF:
+            foldIf(node);
+            break;
+        default:
+            break;
+    }
+}
+
+// Children alternate condition and body, with an optional trailing else
+// body; see Environment::eval_if.
+void Optimizer::foldIf(SyntaxNode *node) {
+    vector<SyntaxNode *> &children = node->children;
+    vector<SyntaxNode *> kept;
+    for (size_t i = 0; i < children.size(); i += 2) {
+        if (i == children.size() - 1 || children[i]->constant == nullptr) {
+            kept.insert(kept.end(), children.begin() + i,
+                        children.begin() + min(i + 2, children.size()));
+            continue;
+        }
+        bool taken = children[i]->constant->isTruthy();
+        delete children[i];
+        if (taken) {
+            // The body becomes the else branch; nothing after it can run.
+            kept.push_back(children[i + 1]);
+            for (size_t j = i + 2; j < children.size(); j++) {
+                delete children[j];
+            }
+            break;
+        }
+        delete children[i + 1];
+    }
+    children = kept;
+}
+
+// Mirrors the Environment operations; returns nullptr for anything that
+// should be left to them.
+Value *Optimizer::evaluate(NodeType type, Value *lhs, Value *rhs) {
+    if (type == NodeType::EQUAL) {
+        return context->newNumberValue(valuesEqual(lhs, rhs) ? 1 : 0);
+    } else if (type == NodeType::NEQ) {
+        return context->newNumberValue(valuesEqual(lhs, rhs) ? 0 : 1);
+    }
+    if (type == NodeType::ADD && lhs->type == ValueType::STRING && rhs->type == ValueType::STRING) {
+        return context->newStringValue(lhs->toStringValue()->value + rhs->toStringValue()->value);
+    }
+    if (lhs->type == ValueType::STRING || rhs->type == ValueType::STRING) {
+        return nullptr;
+    }
+    if (lhs->type == ValueType::NUM_FLOAT || rhs->type == ValueType::NUM_FLOAT) {
+        return evaluateFloat(type, lhs, rhs);
+    }
+    long left = lhs->toNumberValue()->value;
+    long right = rhs->toNumberValue()->value;
+    switch (type) {
+        case NodeType::ADD:
+            return context->newNumberValue(left + right);
+        case NodeType::SUB:
+            return context->newNumberValue(left - right);
+        case NodeType::MUL:
+            return context->newNumberValue(left * right);
+        case NodeType::DIV:
+            if (right == 0 || (left == LONG_MIN && right == -1)) {
+                return nullptr;
+            }
+            return context->newNumberValue(left / right);
+        case NodeType::GT:
+            return context->newNumberValue(left > right ? 1 : 0);
+        case NodeType::LT:
+            return context->newNumberValue(left < right ? 1 : 0);
+        case NodeType::GTE:
+            return context->newNumberValue(left >= right ? 1 : 0);
+        case NodeType::LTE:
+            return context->newNumberValue(left <= right ? 1 : 0);
+        default:
+            return nullptr;
+    }
+}
+
+Value *Optimizer::evaluateFloat(NodeType type, Value *lhs, Value *rhs) {
+    double left = floatValueOf(lhs);
+    double right = floatValueOf(rhs);
+    switch (type) {
+        case NodeType::ADD:
+            return context->newFloatValue(left + right);
+        case NodeType::SUB:
+            return context->newFloatValue(left - right);
+        case NodeType::MUL:
+            return context->newFloatValue(left * right);
+        case NodeType::DIV:
+            return context->newFloatValue(left / right);
+        case NodeType::GT:
+            return context->newNumberValue(left > right ? 1 : 0);
+        case NodeType::LT:
+            return context->newNumberValue(left < right ? 1 : 0);
+        case NodeType::GTE:
+            return context->newNumberValue(left >= right ? 1 : 0);
+        case NodeType::LTE:
+            return context->newNumberValue(left <= right ? 1 : 0);
+        default:
+            return nullptr;
+    }
+}
+
+// Turns an operator node into a literal terminal holding `value`.
+void Optimizer::makeLiteral(SyntaxNode *node, Value *value) {
+    int line = node->children[0]->content.line;
+    for (auto child : node->children) {
+        delete child;
+    }
+    node->children.clear();
+    node->type = NodeType::TERMINAL;
+    if (value->type == ValueType::NUM) {
+        long number = value->toNumberValue()->value;
+        node->content = Token(TokenType::NUMBER, L"", line);
+        node->content.content = to_wstring(number);
+        node->content.number = number;
+    } else if (value->type == ValueType::NUM_FLOAT) {
+        double number = ((FloatValue *) value)->value;
+        node->content = Token(TokenType::NUMBER_FLOAT, L"", line);
+        node->content.content = to_wstring(number);
+        node->content.numberFloat = number;
+    } else {
+        node->content = Token(TokenType::STRING, value->toStringValue()->value.toWString(), line);
+    }
+    value->refs++;
+    node->constant = value;
+}
@@ -0,0 +1,35 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "Parser.h"
+#include "Context.h"
+
+// Rewrites a parsed tree before it runs, for either engine:
+// - every literal gets its value created once and pinned on the node, so
+//   evaluating it no longer allocates;
+// - arithmetic, comparisons and string concatenation whose operands are all
+//   literals are replaced by a literal of their result;
+// - もし branches with literal conditions are dropped when the condition is
+//   false, and end the chain when it is true.
+// Operations that would fail or depend on the environment are left for
+// run time.
+class Optimizer {
+    Context *context;
+
+    void fold(SyntaxNode *node);
+
+    void foldIf(SyntaxNode *node);
+
+    Value *evaluate(NodeType type, Value *lhs, Value *rhs);
+
+    Value *evaluateFloat(NodeType type, Value *lhs, Value *rhs);
+
+    static void makeLiteral(SyntaxNode *node, Value *value);
+
+public:
+    explicit Optimizer(Context *context) : context(context) {}
+
+    void optimize(SyntaxNode *tree);
+};
+
+#endif
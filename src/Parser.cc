@@ -31,6 +31,7 @@ SyntaxNode *Parser::run_statement() {
     } else if ((result = run_nonlocal())) {
     } else if ((result = run_return())) {
     } else if ((result = run_if())) {
+    } else if ((result = run_loop())) {
     } else if ((result = run_assert())) {
     } else if ((result = run_assign())) {
     } else if ((result = run_function())) {
@@ -186,6 +187,65 @@ SyntaxNode *Parser::run_if() {
     return result;
 }
 
+// 繰り返す、条件 runs its body while the condition holds;
+// 繰り返す、名前、から、まで binds 名前 to each integer from から up to but not
+// including まで.
+SyntaxNode *Parser::run_loop() {
+    if (!accept(TokenType::LOOP)) {
+        return nullptr;
+    }
+    if (!expect(TokenType::COMMA)) {
+        logInternal("エラー：繰り返す文不完全\n");
+        return new SyntaxNode(NodeType::PARSE_ERROR);
+    }
+    SyntaxNode *result;
+    Token name;
+    if (accept({TokenType::SYMBOL, TokenType::COMMA}, {&name, nullptr})) {
+        SyntaxNode *from = run_infix_expression();
+        if (!from || from->isError()) {
+            logInternal("エラー：繰り返す文の範囲の始まりをパース出来ない。\n");
+            return from ? from : new SyntaxNode(NodeType::PARSE_ERROR);
+        }
+        if (!expect(TokenType::COMMA)) {
+            logInternal("エラー：繰り返す文の範囲の始まりの後で「、」は必要です。\n");
+            delete from;
+            return new SyntaxNode(NodeType::PARSE_ERROR);
+        }
+        SyntaxNode *to = run_infix_expression();
+        if (!to || to->isError()) {
+            logInternal("エラー：繰り返す文の範囲の終わりをパース出来ない。\n");
+            delete from;
+            return to ? to : new SyntaxNode(NodeType::PARSE_ERROR);
+        }
+        result = new SyntaxNode(NodeType::RANGE_LOOP, {new SyntaxNode(name), from, to});
+    } else {
+        SyntaxNode *condition = run_infix_expression();
+        if (!condition || condition->isError()) {
+            logInternal("エラー：繰り返す文の右側の引数をパース出来ない。\n");
+            return condition ? condition : new SyntaxNode(NodeType::PARSE_ERROR);
+        }
+        result = new SyntaxNode(NodeType::LOOP, {condition});
+    }
+    if (!expect(TokenType::NEWL) || !expect(TokenType::INDENT)) {
+        logInternal("エラー：繰り返す文の一行目の後でnewlineやindentなどはありません。\n");
+        delete result;
+        return new SyntaxNode(NodeType::PARSE_ERROR);
+    }
+    SyntaxNode *body = run_text();
+    if (body->isError()) {
+        logInternal("エラー：繰り返す文の中に問題が起きました。\n");
+        delete result;
+        return body;
+    }
+    result->children.push_back(body);
+    if (!expect(TokenType::DEDENT)) {
+        logInternal("エラー：繰り返す文の中身の後でunindentは必要です。\n");
+        delete result;
+        return new SyntaxNode(NodeType::PARSE_ERROR);
+    }
+    return result;
+}
+
 SyntaxNode *Parser::run_assert() {
     Token assertToken;
     if (accept(TokenType::ASSERT, &assertToken)) {
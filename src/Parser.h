@@ -3,11 +3,17 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <memory>
+
 #include "Tokenizer.h"
 #include "Logger.h"
 
 class SyntaxNode;
 
+class Code;
+
+class Value;
+
 class Parser {
     Tokenizer *lexer;
     vector<Token> allTokens;
@@ -30,6 +36,8 @@ public:
 
     SyntaxNode *run_if();
 
+    SyntaxNode *run_loop();
+
     SyntaxNode *run_assert();
 
     SyntaxNode *run_assign();
@@ -70,14 +78,25 @@ enum class NodeType {
     RETURN, IF, ASSIGN, GET, SET, IMPORT, VARKWPARAM, KWARG,
     VARPARAM, SUB, ADD, EQUAL, NEQ, LT, GT, LTE, GTE,
     ASSERT, DEFAULTPARAM, SUBSCRIPT, SUBSCRIPT_SET, PARSE_ERROR,
-    MUL, DIV, EXTERNAL, GET_BIND, FUNC_NAME
+    MUL, DIV, EXTERNAL, GET_BIND, FUNC_NAME, LOOP, RANGE_LOOP
 };
 const string NodeTypeStrings[] = {
         "CALL", "TERMINAL", "ARGS", "CALL_TAIL", "TEXT", "FUNC", "PARAMS",
         "RETURN", "IF", "ASSIGN", "GET", "SET", "IMPORT", "VARKWPARAM", "KWARG",
         "VARPARAM", "SUB", "ADD", "EQUAL", "NEQ", "LT", "GT", "LTE", "GTE",
         "ASSERT", "DEFAULTPARAM", "SUBSCRIPT", "SUBSCRIPT_SET", "PARSE_ERROR",
-        "MUL", "DIV", "EXTERNAL", "GET_BIND", "FUNC_NAME"
+        "MUL", "DIV", "EXTERNAL", "GET_BIND", "FUNC_NAME", "LOOP", "RANGE_LOOP"
+};
+
+// Where a statement or call sits in the function body being evaluated.
+// Calls in tail position are made as tail calls: the body unwinds first and
+// UserFunctionValue::apply makes the call, so chains of them run in
+// constant stack.
+enum class TailPosition {
+    NONE,       // outside function bodies
+    BODY,       // in a function body, before its end
+    LAST,       // last statement of a function body, whose value is dropped
+    RETURNED    // value of a 返す
 };
 
 class SyntaxNode {
@@ -85,6 +104,12 @@ public:
     NodeType type;
     Token content;
     vector<SyntaxNode *> children;
+    // Value of a literal, created once by the Optimizer and pinned until the
+    // node is deleted, which must happen before its Context is cleaned up.
+    Value *constant = nullptr;
+    // Bytecode for this tree, compiled on its first eval by the VM and kept
+    // so that evaluating it again does not compile it again.
+    shared_ptr<Code> code;
 
     explicit SyntaxNode(NodeType _type) : type(_type) {}
 
@@ -1,6 +1,7 @@
 
 
 #include "Parser.h"
+#include "Value.h"
 
 bool Parser::accept(TokenType type, Token *out) {
     if (currentToken().type == type) {
@@ -125,6 +126,9 @@ SyntaxNode::~SyntaxNode() {
     for (auto child : children) {
         delete child;
     }
+    if (constant) {
+        constant->refs--;
+    }
 }
 
 void Parser::logInternal(string message) {
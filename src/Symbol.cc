@@ -0,0 +1,54 @@
+#include <deque>
+#include <unordered_map>
+
+#include "Symbol.h"
+
+namespace {
+    // Names live in a deque so the references handed out by name() stay
+    // valid as the table grows. Built on first use so that Symbols in static
+    // initializers of other files are safe.
+    struct SymbolTable {
+        deque<wstring> names;
+        unordered_map<wstring, uint32_t> ids;
+
+        SymbolTable() {
+            names.emplace_back();
+            ids[names.back()] = 0;
+        }
+    };
+
+    SymbolTable &table() {
+        static SymbolTable instance;
+        return instance;
+    }
+}
+
+Symbol::Symbol(const wstring &name) {
+    SymbolTable &symbols = table();
+    auto existing = symbols.ids.find(name);
+    if (existing != symbols.ids.end()) {
+        id = existing->second;
+        return;
+    }
+    id = (uint32_t) symbols.names.size();
+    symbols.names.push_back(name);
+    symbols.ids[name] = id;
+}
+
+bool Symbol::find(const wstring &name, Symbol *symbol) {
+    SymbolTable &symbols = table();
+    auto existing = symbols.ids.find(name);
+    if (existing == symbols.ids.end()) {
+        return false;
+    }
+    symbol->id = existing->second;
+    return true;
+}
+
+const wstring &Symbol::name() const {
+    return table().names[id];
+}
+
+size_t Symbol::count() {
+    return table().names.size();
+}
@@ -0,0 +1,52 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+using namespace std;
+
+// An interned name. Every distinct string gets one id from a table shared by
+// the whole process, so comparing and hashing Symbols is integer work and
+// each name is stored once however often it is used. Strings convert
+// implicitly, interning on the way; the table only grows, so only names
+// from source code should be interned. Strings computed at run time go
+// through find instead.
+class Symbol {
+    uint32_t id;
+
+public:
+    // The empty name.
+    Symbol() : id(0) {}
+
+    Symbol(const wstring &name);
+
+    Symbol(const wchar_t *name) : Symbol(wstring(name)) {}
+
+    const wstring &name() const;
+
+    uint32_t getId() const { return id; }
+
+    bool empty() const { return id == 0; }
+
+    bool operator==(const Symbol &rhs) const { return id == rhs.id; }
+
+    bool operator!=(const Symbol &rhs) const { return id != rhs.id; }
+
+    // Sets `symbol` to the Symbol for `name` if it was interned already,
+    // without interning it otherwise.
+    static bool find(const wstring &name, Symbol *symbol);
+
+    // Number of names interned so far.
+    static size_t count();
+};
+
+namespace std {
+    template<>
+    struct hash<Symbol> {
+        size_t operator()(const Symbol &symbol) const { return symbol.getId(); }
+    };
+}
+
+#endif
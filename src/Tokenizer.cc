@@ -106,7 +106,8 @@ const unordered_map<wstring, TokenType> identifiers(
                 {L"その他",  TokenType::ELSE},
                 {L"導入",   TokenType::IMPORT},
                 {L"確認",   TokenType::ASSERT},
-                {L"外側",   TokenType::EXTERN}
+                {L"外側",   TokenType::EXTERN},
+                {L"繰り返す", TokenType::LOOP}
         });
 
 bool charIsSymbolic(wchar_t c) {
@@ -149,6 +150,9 @@ Token::Token(TokenType type, wstring _content, int line)
     if (type == TokenType::NUMBER_FLOAT) {
         numberFloat = parseNumericFloat(content);
     }
+    if (type == TokenType::SYMBOL) {
+        symbol = Symbol(content);
+    }
 }
 
 string Token::toString() const {
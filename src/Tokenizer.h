@@ -11,6 +11,7 @@
 #include <sstream>
 #include <queue>
 #include "InputSource.h"
+#include "Symbol.h"
 
 using namespace std;
 
@@ -25,14 +26,14 @@ enum TokenType {
     INDENT, DEDENT, NUMBER, NUMBER_FLOAT, FUNC, RETURN, IF, ELSE, STRING,
     ASSIGN, DOT, ELIF, MINUS, IMPORT, STAR, COLON, PLUS,
     SLASH, EQ, LEQ, GEQ, LT, GT, NEQ, ASSERT, LBRACE, RBRACE,
-    EXTERN, NAMI
+    EXTERN, NAMI, LOOP
 };
 static const char *TokenTypeStrings[] = {
         "lparen", "rparen", "comma", "symbol", "end", "start", "space", "newl",
         "indent", "dedent", "number", "number_float", "function", "return", "if", "else", "string",
         "assign", "dot", "elif", "minus", "import", "star", "colon", "plus",
         "slash", "eq", "leq", "geq", "lt", "gt", "neq", "assert", "lbrace",
-        "rbrace", "extern", "nami"
+        "rbrace", "extern", "nami", "loop"
 };
 
 const char* tokenTypeToString(TokenType type);
@@ -45,6 +46,8 @@ public:
 
     TokenType type;
     wstring content;
+    // Interned content of SYMBOL tokens.
+    Symbol symbol;
     int line;
     long number{};
     double numberFloat{};
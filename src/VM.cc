@@ -0,0 +1,621 @@
+#include "VM.h"
+#include "Context.h"
+
+// Dispatch jumps straight from one handler to the next through a table of
+// label addresses where the compiler supports it, and through a switch
+// otherwise.
+#ifdef __GNUC__
+#define DISPATCH() do { instruction = ip++; goto *dispatchTable[(size_t) instruction->op]; } while (0)
+#define TARGET(name) label_##name:
+#else
+#define DISPATCH() goto dispatch
+#define TARGET(name) case Op::name:
+#endif
+
+// Puts a quickened instruction back to its generic form for good and runs
+// it again.
+#define DEOPTIMIZE() do { \
+        instruction->op = (Op) instruction->operand; \
+        instruction->deoptimized = true; \
+        ip--; \
+        DISPATCH(); \
+    } while (0)
+
+// Quickened operators work on the words themselves, so their results are
+// only allocated when an integer outgrows a word.
+#define INT_OPERATOR(name, result) \
+    TARGET(name) { \
+        Word lhs = stack[stack.size() - 2]; \
+        Word rhs = stack.back(); \
+        if (!isInteger(lhs) || !isInteger(rhs)) { \
+            DEOPTIMIZE(); \
+        } \
+        long left = integerValueOf(lhs); \
+        long right = integerValueOf(rhs); \
+        stack.pop_back(); \
+        stack.back() = integerWord(context, result); \
+        DISPATCH(); \
+    }
+
+#define FLOAT_OPERATOR(name, wordOf, result) \
+    TARGET(name) { \
+        Word lhs = stack[stack.size() - 2]; \
+        Word rhs = stack.back(); \
+        if (!isNumeric(lhs) || !isNumeric(rhs) || (isInteger(lhs) && isInteger(rhs))) { \
+            DEOPTIMIZE(); \
+        } \
+        double left = floatValueOf(lhs); \
+        double right = floatValueOf(rhs); \
+        stack.pop_back(); \
+        stack.back() = Word::wordOf(result); \
+        DISPATCH(); \
+    }
+
+// Runs a generic operator on the operands boxed as Values.
+#define GENERIC_OPERATOR(name, operation) \
+    TARGET(name) { \
+        quicken(instruction, stack[stack.size() - 2], stack.back()); \
+        Value *lhs = boxInPlace(context, stack[stack.size() - 2]); \
+        Value *result = env->operation(lhs, boxInPlace(context, stack.back())); \
+        stack.pop_back(); \
+        stack.back() = Word::of(result); \
+        DISPATCH(); \
+    }
+
+// Hands `value` from an inline frame back to the frame that called it and
+// resumes the caller. Returning is a safepoint so that values built while
+// a deep recursion unwinds can be collected.
+#define LEAVE_FRAME(value) do { \
+        Word returned = dropResult ? Word::none() : (value); \
+        const Frame &caller = frames.back(); \
+        stack.resize(base - 1); \
+        stack.push_back(returned); \
+        code = caller.code; \
+        env = caller.env; \
+        instructions = caller.instructions; \
+        ip = caller.ip; \
+        base = caller.base; \
+        running = caller.running; \
+        dropResult = caller.dropResult; \
+        frames.pop_back(); \
+        context->leaveCall(); \
+        context->collect(env); \
+        DISPATCH(); \
+    } while (0)
+
+// Drops every frame of this run once Completion::ERROR is pending.
+#define ABORT() do { \
+        context->callDepth -= frames.size(); \
+        stack.resize(entryBase); \
+        return Context::unwindSignal(); \
+    } while (0)
+
+// A suspended caller. Its operands start at `base`; the stack slot just
+// below holds the function it runs, which keeps that function alive.
+struct Frame {
+    const Code *code;
+    Environment *env;
+    Instruction *instructions;
+    Instruction *ip;
+    size_t base;
+    const UserFunctionValue *running;
+    bool dropResult;
+};
+
+// The user function with compiled code that a call ends up in; null for
+// anything else, which is called through apply.
+static const UserFunctionValue *compiledCallee(const FunctionValue *function) {
+    while (function->functionType == FunctionValueType::BOUND_FUNCTION) {
+        function = static_cast<const BoundFunctionValue *>(function)->function;
+    }
+    if (function->functionType != FunctionValueType::USER_FUNCTION ||
+        static_cast<const UserFunctionValue *>(function)->code == nullptr) {
+        return nullptr;
+    }
+    return static_cast<const UserFunctionValue *>(function);
+}
+
+// Puts the receivers of bound functions in front of `args`.
+static void addReceivers(const FunctionValue *function, vector<Word> &args) {
+    while (function->functionType == FunctionValueType::BOUND_FUNCTION) {
+        auto bound = static_cast<const BoundFunctionValue *>(function);
+        args.insert(args.begin(), Word(bound->jibun));
+        function = bound->function;
+    }
+}
+
+static Word integerWord(Context *context, long number) {
+    return Word::fitsInt(number) ? Word::fromInt(number) : Word(context->newNumberValue(number));
+}
+
+// Boxes the word at a stack slot and leaves the box there, so that it stays
+// rooted while whatever it is handed to runs.
+static Value *boxInPlace(Context *context, Word &word) {
+    Value *value = context->box(word);
+    if (!word.isPointer()) {
+        word = Word(value);
+    }
+    return value;
+}
+
+// The quickened form of a generic operator for the operands it is about to
+// run on, or the generic operator itself.
+static Op quickenedOp(Op generic, Word lhs, Word rhs) {
+    bool integers = isInteger(lhs) && isInteger(rhs);
+    bool numbers = isNumeric(lhs) && isNumeric(rhs);
+    switch (generic) {
+        case Op::ADD:
+            if (lhs.type() == ValueType::STRING && rhs.type() == ValueType::STRING) {
+                return Op::CONCAT;
+            }
+            return integers ? Op::ADD_INT : numbers ? Op::ADD_FLOAT : generic;
+        case Op::SUB:
+            return integers ? Op::SUB_INT : numbers ? Op::SUB_FLOAT : generic;
+        case Op::MUL:
+            return integers ? Op::MUL_INT : numbers ? Op::MUL_FLOAT : generic;
+        case Op::DIV:
+            return integers ? Op::DIV_INT : numbers ? Op::DIV_FLOAT : generic;
+        case Op::EQUAL:
+            return integers ? Op::EQUAL_INT : generic;
+        case Op::NEQ:
+            return integers ? Op::NEQ_INT : generic;
+        case Op::GT:
+            return integers ? Op::GT_INT : numbers ? Op::GT_FLOAT : generic;
+        case Op::LT:
+            return integers ? Op::LT_INT : numbers ? Op::LT_FLOAT : generic;
+        case Op::GTE:
+            return integers ? Op::GTE_INT : numbers ? Op::GTE_FLOAT : generic;
+        case Op::LTE:
+            return integers ? Op::LTE_INT : numbers ? Op::LTE_FLOAT : generic;
+        default:
+            return generic;
+    }
+}
+
+static void quicken(Instruction *instruction, Word lhs, Word rhs) {
+    if (!instruction->deoptimized) {
+        Op quickened = quickenedOp(instruction->op, lhs, rhs);
+        if (quickened != instruction->op) {
+            instruction->operand = (uint32_t) instruction->op;
+            instruction->op = quickened;
+        }
+    }
+}
+
+Value *VM::run(const Code *code, Environment *env, const UserFunctionValue *function) {
+    vector<Word> &stack = context->rootStack;
+    const size_t entryBase = stack.size();
+    const UserFunctionValue *running = function;
+    stack.push_back(function ? Word(const_cast<UserFunctionValue *>(function)) : Word::none());
+    size_t base = stack.size();
+    bool dropResult = false;
+    vector<Frame> frames;
+    vector<Word> args;
+    vector<Value *> boxedArgs;
+    unordered_map<Symbol, Value *> kwargs;
+    Instruction *instructions = code->instructions.data();
+    Instruction *ip = instructions;
+    Instruction *instruction;
+    context->collect(env);
+
+#ifdef __GNUC__
+    static void *const dispatchTable[] = {
+            &&label_LOAD_NONE, &&label_LOAD_NUMBER, &&label_LOAD_FLOAT, &&label_LOAD_STRING,
+            &&label_LOAD_CONSTANT, &&label_LOAD_NAME, &&label_LOAD_GLOBAL, &&label_LOAD_LOCAL, &&label_LOAD_OUTER,
+            &&label_STORE_NAME, &&label_STORE_LOCAL, &&label_STORE_NONLOCAL,
+            &&label_DEFINE_NAME, &&label_DEFINE_MEMBER, &&label_POP,
+            &&label_ADD, &&label_SUB, &&label_MUL, &&label_DIV, &&label_EQUAL, &&label_NEQ,
+            &&label_GT, &&label_LT, &&label_GTE, &&label_LTE,
+            &&label_ADD_INT, &&label_SUB_INT, &&label_MUL_INT, &&label_DIV_INT,
+            &&label_EQUAL_INT, &&label_NEQ_INT, &&label_GT_INT, &&label_LT_INT,
+            &&label_GTE_INT, &&label_LTE_INT,
+            &&label_ADD_FLOAT, &&label_SUB_FLOAT, &&label_MUL_FLOAT, &&label_DIV_FLOAT,
+            &&label_GT_FLOAT, &&label_LT_FLOAT, &&label_GTE_FLOAT, &&label_LTE_FLOAT,
+            &&label_CONCAT,
+            &&label_CALL, &&label_GET, &&label_GET_BIND, &&label_SUBSCRIPT, &&label_SET,
+            &&label_SUBSCRIPT_SET, &&label_JUMP, &&label_JUMP_IF_FALSE, &&label_JUMP_BACK,
+            &&label_FOR_RANGE, &&label_MAKE_FUNCTION,
+            &&label_IMPORT, &&label_NONLOCAL, &&label_ASSERT, &&label_RETURN, &&label_RESULT,
+            &&label_END
+    };
+    static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == OpCount,
+                  "dispatch table out of step with Op");
+    DISPATCH();
+#else
+    dispatch:
+    instruction = ip++;
+    switch (instruction->op) {
+#endif
+    TARGET(LOAD_NONE) {
+        stack.push_back(Word::none());
+        DISPATCH();
+    }
+    TARGET(LOAD_NUMBER) {
+        stack.push_back(integerWord(context, code->numbers[instruction->operand]));
+        DISPATCH();
+    }
+    TARGET(LOAD_FLOAT) {
+        stack.push_back(Word::fromFloat(code->floats[instruction->operand]));
+        DISPATCH();
+    }
+    TARGET(LOAD_STRING) {
+        stack.push_back(context->newStringValue(code->strings[instruction->operand]));
+        DISPATCH();
+    }
+    TARGET(LOAD_CONSTANT) {
+        stack.push_back(Word::of(code->constants[instruction->operand]));
+        DISPATCH();
+    }
+    TARGET(LOAD_NAME) {
+        stack.push_back(Word::of(env->lookup(code->names[instruction->operand])));
+        DISPATCH();
+    }
+    TARGET(LOAD_GLOBAL) {
+        Environment *scope = env;
+        for (size_t depth = instruction->depth; depth > 0; depth--) {
+            scope = scope->parent;
+        }
+        stack.push_back(Word::of(scope->lookup(code->names[instruction->operand])));
+        DISPATCH();
+    }
+    TARGET(LOAD_LOCAL) {
+        Word value = env->slots[instruction->operand];
+        if (value.isNull()) {
+            value = Word::of(env->parent->lookup(code->slotNames[instruction->operand]));
+        }
+        stack.push_back(value);
+        DISPATCH();
+    }
+    TARGET(LOAD_OUTER) {
+        Environment *scope = env;
+        for (size_t depth = instruction->depth; depth > 0; depth--) {
+            scope = scope->parent;
+        }
+        Word value = scope->slots[instruction->operand];
+        if (value.isNull()) {
+            value = Word::of(scope->parent->lookup(scope->frame->slotNames[instruction->operand]));
+        }
+        stack.push_back(value);
+        DISPATCH();
+    }
+    TARGET(STORE_NAME) {
+        env->bind(code->names[instruction->operand], context->box(stack.back()));
+        stack.pop_back();
+        DISPATCH();
+    }
+    TARGET(STORE_LOCAL) {
+        env->setSlot(instruction->operand, stack.back());
+        stack.pop_back();
+        DISPATCH();
+    }
+    TARGET(STORE_NONLOCAL) {
+        env->parent->bind(code->names[instruction->operand], context->box(stack.back()), true);
+        stack.pop_back();
+        DISPATCH();
+    }
+    TARGET(DEFINE_NAME) {
+        Value *function = stack.back().asPointer();
+        env->forgetCounter(code->names[instruction->operand]);
+        env->bindings[code->names[instruction->operand]] = function;
+        env->writeBarrier(function);
+        stack.pop_back();
+        DISPATCH();
+    }
+    TARGET(DEFINE_MEMBER) {
+        Word dictionary = stack.back();
+        if (dictionary.type() != ValueType::DICT) {
+            cout << "error not of type dict" << endl;
+        } else {
+            static_cast<DictionaryValue *>(dictionary.asPointer())->set(
+                    code->names[instruction->operand], boxInPlace(context, stack[stack.size() - 2]));
+        }
+        stack.resize(stack.size() - 2);
+        DISPATCH();
+    }
+    TARGET(POP) {
+        stack.pop_back();
+        DISPATCH();
+    }
+    GENERIC_OPERATOR(ADD, add)
+    GENERIC_OPERATOR(SUB, subtract)
+    GENERIC_OPERATOR(MUL, multiply)
+    GENERIC_OPERATOR(DIV, divide)
+    GENERIC_OPERATOR(EQUAL, equal)
+    GENERIC_OPERATOR(NEQ, notEqual)
+    GENERIC_OPERATOR(GT, greater)
+    GENERIC_OPERATOR(LT, less)
+    GENERIC_OPERATOR(GTE, greaterOrEqual)
+    GENERIC_OPERATOR(LTE, lessOrEqual)
+    INT_OPERATOR(ADD_INT, left + right)
+    INT_OPERATOR(SUB_INT, left - right)
+    INT_OPERATOR(MUL_INT, left * right)
+    INT_OPERATOR(DIV_INT, left / right)
+    INT_OPERATOR(EQUAL_INT, left == right ? 1 : 0)
+    INT_OPERATOR(NEQ_INT, left != right ? 1 : 0)
+    INT_OPERATOR(GT_INT, left > right ? 1 : 0)
+    INT_OPERATOR(LT_INT, left < right ? 1 : 0)
+    INT_OPERATOR(GTE_INT, left >= right ? 1 : 0)
+    INT_OPERATOR(LTE_INT, left <= right ? 1 : 0)
+    FLOAT_OPERATOR(ADD_FLOAT, fromFloat, left + right)
+    FLOAT_OPERATOR(SUB_FLOAT, fromFloat, left - right)
+    FLOAT_OPERATOR(MUL_FLOAT, fromFloat, left * right)
+    FLOAT_OPERATOR(DIV_FLOAT, fromFloat, left / right)
+    FLOAT_OPERATOR(GT_FLOAT, fromInt, left > right ? 1 : 0)
+    FLOAT_OPERATOR(LT_FLOAT, fromInt, left < right ? 1 : 0)
+    FLOAT_OPERATOR(GTE_FLOAT, fromInt, left >= right ? 1 : 0)
+    FLOAT_OPERATOR(LTE_FLOAT, fromInt, left <= right ? 1 : 0)
+    TARGET(CONCAT) {
+        Word lhs = stack[stack.size() - 2];
+        Word rhs = stack.back();
+        if (lhs.type() != ValueType::STRING || rhs.type() != ValueType::STRING) {
+            DEOPTIMIZE();
+        }
+        Value *result = context->newStringValue(
+                lhs.asPointer()->toStringValue()->value + rhs.asPointer()->toStringValue()->value);
+        stack.pop_back();
+        stack.back() = result;
+        DISPATCH();
+    }
+    TARGET(CALL) {
+        const CallSite &site = code->callSites[instruction->operand];
+        const size_t functionIndex = stack.size() - site.argc - 1;
+        Word functionInput = stack[functionIndex];
+        if (functionInput.type() != ValueType::FUNC) {
+            env->logger->log("実行エラー：関数型ではない物を呼べません。")->logEndl();
+            stack.resize(functionIndex);
+            stack.push_back(Word::none());
+            ip = instructions + instruction->target;
+            DISPATCH();
+        }
+        auto function = static_cast<FunctionValue *>(functionInput.asPointer());
+        const UserFunctionValue *callee = compiledCallee(function);
+        kwargs.clear();
+        if (callee == nullptr) {
+            // Builtins take Values, so the arguments are boxed where they
+            // lie on the stack once the safepoint is behind us.
+            context->collect(env);
+            boxedArgs.clear();
+            for (size_t i = 0; i < site.argc; i++) {
+                Value *argument = boxInPlace(context, stack[functionIndex + 1 + i]);
+                if (site.hasKeywords && !site.keywords[i].empty()) {
+                    kwargs[site.keywords[i]] = argument;
+                } else {
+                    boxedArgs.push_back(argument);
+                }
+            }
+            Value *result = function->apply(boxedArgs, env, kwargs.empty() ? nullptr : &kwargs);
+            if (context->completion.status == Completion::ERROR) {
+                ABORT();
+            }
+            stack.resize(functionIndex);
+            stack.push_back(Word::of(result));
+            DISPATCH();
+        }
+        args.clear();
+        for (size_t i = 0; i < site.argc; i++) {
+            if (site.hasKeywords && !site.keywords[i].empty()) {
+                kwargs[site.keywords[i]] = boxInPlace(context, stack[functionIndex + 1 + i]);
+            } else {
+                args.push_back(stack[functionIndex + 1 + i]);
+            }
+        }
+        addReceivers(function, args);
+        unordered_map<Symbol, Value *> *keywords = kwargs.empty() ? nullptr : &kwargs;
+        if (site.tail == TailPosition::LAST || site.tail == TailPosition::RETURNED) {
+            // The callee takes over the running frame.
+            stack.resize(base);
+            stack[base - 1] = Word(const_cast<UserFunctionValue *>(callee));
+            dropResult = dropResult || site.tail == TailPosition::LAST;
+            if (callee == running) {
+                env->tailReset();
+            } else {
+                Environment *caller = env->caller;
+                env = callee->parentEnv->newChildEnvironment();
+                env->caller = caller;
+                env->enterFrame(callee->code);
+            }
+        } else {
+            if (!context->enterCall(env)) {
+                ABORT();
+            }
+            frames.push_back({code, env, instructions, ip, base, running, dropResult});
+            stack.resize(functionIndex + 1);
+            stack[functionIndex] = Word(const_cast<UserFunctionValue *>(callee));
+            base = functionIndex + 1;
+            dropResult = false;
+            Environment *caller = env;
+            env = callee->parentEnv->newChildEnvironment();
+            env->caller = caller;
+            env->enterFrame(callee->code);
+        }
+        running = callee;
+        code = callee->code.get();
+        instructions = code->instructions.data();
+        ip = instructions;
+        if (!callee->bindArguments(env, args, keywords)) {
+            if (frames.empty()) {
+                stack.resize(entryBase);
+                return Context::newNoneValue();
+            }
+            LEAVE_FRAME(Word::none());
+        }
+        context->collect(env);
+        DISPATCH();
+    }
+    TARGET(GET) {
+        PropertySite &site = code->properties[instruction->operand];
+        Value *result = env->getMember(boxInPlace(context, stack.back()), code->names[site.name], &site.cache);
+        if (result == nullptr) {
+            stack.back() = Word::none();
+            ip = instructions + instruction->target;
+        } else {
+            stack.back() = Word::of(result);
+        }
+        DISPATCH();
+    }
+    TARGET(GET_BIND) {
+        PropertySite &site = code->properties[instruction->operand];
+        Value *result = env->bindMember(boxInPlace(context, stack.back()), code->names[site.name], &site.cache);
+        if (result == nullptr) {
+            stack.back() = Word::none();
+            ip = instructions + instruction->target;
+        } else {
+            stack.back() = Word::of(result);
+        }
+        DISPATCH();
+    }
+    TARGET(SUBSCRIPT) {
+        Word target = stack[stack.size() - 2];
+        Word index = stack.back();
+        if (target.type() == ValueType::ARRAY && index.isInt()) {
+            // Array elements are words already, so they need no boxing.
+            auto array = static_cast<ArrayValue *>(target.asPointer());
+            long i = index.asInt();
+            if (i >= 0 && (size_t) i < array->value.size()) {
+                stack.pop_back();
+                stack.back() = array->value[i];
+                DISPATCH();
+            }
+        }
+        Value *result = env->subscript(boxInPlace(context, stack[stack.size() - 2]),
+                                       boxInPlace(context, stack.back()));
+        stack.pop_back();
+        if (result == nullptr) {
+            stack.back() = Word::none();
+            ip = instructions + instruction->target;
+        } else {
+            stack.back() = Word::of(result);
+        }
+        DISPATCH();
+    }
+    TARGET(SET) {
+        env->setMember(boxInPlace(context, stack[stack.size() - 2]), code->names[instruction->operand],
+                       boxInPlace(context, stack.back()));
+        stack.pop_back();
+        stack.back() = Word::none();
+        DISPATCH();
+    }
+    TARGET(SUBSCRIPT_SET) {
+        Word target = stack[stack.size() - 3];
+        Word index = stack[stack.size() - 2];
+        if (target.type() == ValueType::ARRAY && index.isInt()) {
+            auto array = static_cast<ArrayValue *>(target.asPointer());
+            long i = index.asInt();
+            if (i >= 0 && (size_t) i < array->value.size()) {
+                array->set(i, stack.back());
+                stack.resize(stack.size() - 2);
+                stack.back() = Word::none();
+                DISPATCH();
+            }
+        }
+        env->setSubscript(boxInPlace(context, stack[stack.size() - 3]),
+                          boxInPlace(context, stack[stack.size() - 2]),
+                          boxInPlace(context, stack.back()));
+        stack.resize(stack.size() - 2);
+        stack.back() = Word::none();
+        DISPATCH();
+    }
+    TARGET(JUMP) {
+        ip = instructions + instruction->target;
+        DISPATCH();
+    }
+    TARGET(JUMP_IF_FALSE) {
+        bool truthy = stack.back().isTruthy();
+        stack.pop_back();
+        if (!truthy) {
+            ip = instructions + instruction->target;
+        }
+        DISPATCH();
+    }
+    TARGET(JUMP_BACK) {
+        context->collect(env);
+        ip = instructions + instruction->target;
+        DISPATCH();
+    }
+    TARGET(FOR_RANGE) {
+        Word counter = stack[stack.size() - 2];
+        Word limit = stack.back();
+        if (isInteger(counter) && isInteger(limit)) {
+            long value = integerValueOf(counter);
+            if (value < integerValueOf(limit)) {
+                stack[stack.size() - 2] = integerWord(context, value + 1);
+                stack.push_back(counter);
+                DISPATCH();
+            }
+        } else {
+            env->logger->log("実行エラー：繰り返す文の範囲は整数が必要です。")->logEndl();
+        }
+        stack.resize(stack.size() - 2);
+        ip = instructions + instruction->target;
+        DISPATCH();
+    }
+    TARGET(MAKE_FUNCTION) {
+        const FunctionTemplate &function = code->functions[instruction->operand];
+        const size_t defaultsIndex = stack.size() - function.defaultParams.size();
+        unordered_map<Symbol, Value *> paramsWithDefault;
+        for (size_t i = 0; i < function.defaultParams.size(); i++) {
+            paramsWithDefault[function.defaultParams[i]] = boxInPlace(context, stack[defaultsIndex + i]);
+        }
+        auto value = context->newUserFunctionValue(
+                function.params, paramsWithDefault, function.bodyNode, env);
+        value->code = function.body;
+        if (function.hasVarKeywordParam) {
+            value->setVarKeywordParam(function.varKeywordParam);
+        }
+        if (function.hasVarParam) {
+            value->setVarParam(function.varParam);
+        }
+        stack.resize(defaultsIndex);
+        stack.push_back(Word(value));
+        DISPATCH();
+    }
+    TARGET(IMPORT) {
+        env->importModule(code->imports[instruction->operand]);
+        DISPATCH();
+    }
+    TARGET(NONLOCAL) {
+        env->nonlocals.insert(code->names[instruction->operand]);
+        DISPATCH();
+    }
+    TARGET(ASSERT) {
+        Value *result = env->checkAssertion(boxInPlace(context, stack.back()), instruction->operand);
+        stack.pop_back();
+        if (result == Context::unwindSignal()) {
+            if (frames.empty()) {
+                stack.resize(entryBase);
+                return result;
+            }
+            LEAVE_FRAME(Word::of(context->completedValue(result)));
+        }
+        DISPATCH();
+    }
+    TARGET(RETURN) {
+        Word result = stack.back();
+        if (frames.empty()) {
+            Value *returned = dropResult ? Context::newNoneValue() : context->box(result);
+            stack.resize(entryBase);
+            return context->signalReturn(returned);
+        }
+        LEAVE_FRAME(result);
+    }
+    TARGET(RESULT) {
+        Word result = stack.back();
+        if (frames.empty()) {
+            Value *returned = context->box(result);
+            stack.resize(entryBase);
+            return returned;
+        }
+        LEAVE_FRAME(result);
+    }
+    TARGET(END) {
+        if (frames.empty()) {
+            stack.resize(entryBase);
+            return Context::newNoneValue();
+        }
+        LEAVE_FRAME(Word::none());
+    }
+#ifndef __GNUC__
+    }
+    return Context::newNoneValue();
+#endif
+}
@@ -0,0 +1,25 @@
+#ifndef VM_H
+#define VM_H
+
+#include "Bytecode.h"
+#include "Value.h"
+
+// Runs compiled Code. The operand stack is the Context's root stack, so
+// every value the VM holds is a root for the collector without extra
+// bookkeeping. It holds Words: integers and floats stay unboxed there and in
+// frame slots, and are boxed only when handed to a builtin or a binding.
+// Calls between compiled functions push a frame on a heap allocated frame
+// stack instead of recursing, so pin recursion is bounded by
+// Context::setMaxCallDepth rather than the native stack.
+class VM {
+    Context *context;
+
+public:
+    explicit VM(Context *context) : context(context) {}
+
+    // Like Environment::eval, the result may be Context::unwindSignal() after
+    // a 返す or an error. `function` is the function whose body `code` is.
+    Value *run(const Code *code, Environment *env, const UserFunctionValue *function = nullptr);
+};
+
+#endif
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <utility>
 
 #include <iostream>
@@ -6,6 +7,8 @@
 #include "Environment.h"
 #include "Context.h"
 #include "Logger.h"
+#include "VM.h"
+#include "Bytecode.h"
 
 bool Value::equals(const Value *rhs) const {
     return (type == rhs->type);
@@ -80,6 +83,15 @@ bool FloatValue::equals(const Value *rhs) const {
     return Value::equals(rhs) && ( abs(value - ((FloatValue *) rhs)->value) < EPSILON);
 }
 
+bool valuesEqual(const Value *lhs, const Value *rhs) {
+    if (lhs->type != rhs->type && isNumeric(lhs) && isNumeric(rhs)) {
+        FloatValue left(floatValueOf(lhs));
+        FloatValue right(floatValueOf(rhs));
+        return left.equals(&right);
+    }
+    return lhs->equals(rhs);
+}
+
 string FloatValue::toString() const {
     ostringstream result;
     result << "FloatValue(" << value << ")";
@@ -98,27 +110,183 @@ string StringValue::toString() const {
 
 string StringValue::toStringJP() const {
     ostringstream result;
-    result << "「" << encodeUTF8(value) << "」";
+    result << "「" << value.toUTF8() << "」";
     return result.str();
 }
 
+size_t StringValue::memorySize() const {
+    return sizeof(StringValue) + value.memorySize();
+}
+
 bool StringValue::equals(const Value *rhs) const {
     return Value::equals(rhs) && (value == ((const StringValue *) (rhs))->value);
 }
 
 string DictionaryValue::toString() const {
     ostringstream result;
-    result << "DictionaryValue(" << value.size() << ")";
+    result << "DictionaryValue(" << size() << ")";
     return result.str();
 }
 
 string DictionaryValue::toStringJP() const {
     ostringstream result;
-    result << "辞書〈長さ：" << value.size() << "〉";
+    result << "辞書〈長さ：" << size() << "〉";
     return result.str();
 }
 
-DictionaryValue::DictionaryValue() : Value(ValueType::DICT), parent(nullptr) {}
+size_t DictionaryValue::memorySize() const {
+    return sizeof(DictionaryValue) + slots.capacity() * sizeof(Value *) +
+           table.size() * (sizeof(pair<const Symbol, Value *>) + 2 * sizeof(void *)) +
+           table.bucket_count() * sizeof(void *) +
+           entries.size() * (sizeof(pair<const CompactString, Value *>) + 2 * sizeof(void *)) +
+           entries.bucket_count() * sizeof(void *);
+}
+
+void DictionaryValue::rememberSelf() {
+    context->remember(this);
+}
+
+DictionaryValue::DictionaryValue(Shape *shape) : Value(ValueType::DICT), shape(shape), parent(nullptr) {}
+
+Shape *Shape::add(Symbol key) {
+    auto transition = transitions.find(key);
+    if (transition != transitions.end()) {
+        return transition->second.get();
+    }
+    if (keys.size() >= MAX_KEYS || transitions.size() >= MAX_TRANSITIONS) {
+        return nullptr;
+    }
+    auto child = new Shape();
+    child->keys = keys;
+    child->keys.push_back(key);
+    child->slots = slots;
+    child->slots[key] = (uint32_t) keys.size();
+    transitions[key] = unique_ptr<Shape>(child);
+    return child;
+}
+
+void DictionaryValue::convertToTable() {
+    for (size_t i = 0; i < slots.size(); i++) {
+        table[shape->keys[i]] = slots[i];
+    }
+    shape = nullptr;
+    slots.clear();
+    slots.shrink_to_fit();
+}
+
+void DictionaryValue::set(Symbol name, Value *v) {
+    writeBarrier(v);
+    if (shape == nullptr) {
+        if (!entries.empty()) {
+            entries.erase(name.name());
+        }
+        table[name] = v;
+        return;
+    }
+    auto slot = shape->find(name);
+    if (slot != Shape::NOT_FOUND) {
+        slots[slot] = v;
+        return;
+    }
+    auto next = shape->add(name);
+    if (next == nullptr) {
+        convertToTable();
+        table[name] = v;
+        return;
+    }
+    shape = next;
+    slots.push_back(v);
+}
+
+void DictionaryValue::setEntry(Symbol name, Value *v) {
+    if (shape && shape->find(name) == Shape::NOT_FOUND) {
+        convertToTable();
+    }
+    set(name, v);
+}
+
+void DictionaryValue::setEntry(const CompactString &key, Value *v) {
+    Symbol name;
+    if (Symbol::find(key.toWString(), &name)) {
+        setEntry(name, v);
+        return;
+    }
+    if (shape) {
+        convertToTable();
+    }
+    writeBarrier(v);
+    entries[key] = v;
+}
+
+Value *DictionaryValue::getOwnEntry(const CompactString &key) const {
+    Symbol name;
+    if (Symbol::find(key.toWString(), &name)) {
+        return getOwn(name);
+    }
+    return findEntry(key);
+}
+
+Value *DictionaryValue::getEntry(const CompactString &key) {
+    Symbol name;
+    if (Symbol::find(key.toWString(), &name)) {
+        return get(name);
+    }
+    for (auto dictionary = this; dictionary; dictionary = dictionary->parent) {
+        if (auto result = dictionary->findEntry(key)) {
+            return result;
+        }
+    }
+    return nullptr;
+}
+
+Value *DictionaryValue::get(Symbol name, PropertyCache &cache) {
+    for (size_t i = 0; i < cache.count; i++) {
+        const PropertyCache::Entry &entry = cache.entries[i];
+        if (entry.shape != shape || shape == nullptr) {
+            continue;
+        }
+        if (entry.holder == nullptr) {
+            return slots[entry.slot];
+        }
+        if (entry.holder == parent && parent->shape == entry.holderShape) {
+            return parent->slots[entry.slot];
+        }
+    }
+    if (auto result = getOwn(name)) {
+        if (shape) {
+            cache.record({shape, nullptr, nullptr, shape->find(name)});
+        }
+        return result;
+    }
+    if (parent == nullptr) {
+        return nullptr;
+    }
+    if (auto result = parent->getOwn(name)) {
+        if (shape && parent->shape) {
+            cache.record({shape, parent, parent->shape, parent->shape->find(name)});
+        }
+        return result;
+    }
+    return parent->parent ? parent->parent->get(name) : nullptr;
+}
+
+vector<CompactString> DictionaryValue::keys() const {
+    vector<CompactString> result;
+    result.reserve(size());
+    if (shape) {
+        for (Symbol key : shape->keys) {
+            result.emplace_back(key.name());
+        }
+        return result;
+    }
+    for (const auto &entry : table) {
+        result.emplace_back(entry.first.name());
+    }
+    for (const auto &entry : entries) {
+        result.push_back(entry.first);
+    }
+    return result;
+}
 
 bool DictionaryValue::equals(const Value *rhs) const {
     return this == rhs;
@@ -130,95 +298,171 @@ string UserFunctionValue::toString() const {
     return result.str();
 }
 
+size_t UserFunctionValue::memorySize() const {
+    return sizeof(UserFunctionValue) + params.size() * sizeof(Symbol) +
+           paramsWithDefault.size() * (sizeof(pair<const Symbol, Value *>) + 2 * sizeof(void *));
+}
+
+static Value *boxed(Context *, Value *value) {
+    return value;
+}
+
+static Value *boxed(Context *context, Word word) {
+    return context->box(word);
+}
+
+// Shared by the tree walker, which passes Values, and the VM, which passes
+// the words on its stack.
+template<typename Argument>
+bool UserFunctionValue::bindArgumentList(Environment *env, const vector<Argument> &args,
+                                         unordered_map<Symbol, Value *> *kwArgs) const {
+    Context *context = env->context;
+    if (params.size() > args.size()) {
+        // TODO: also log original function name
+        ConsoleLogger().log("エラー：引数は足りません　")
+                ->log("必要は")->logLong((long) params.size())
+                ->log(" 渡したのは")->logLong((long) args.size())
+                ->logEndl();
+        return false;
+    }
+
+    // bind normal params
+    for (size_t i = 0; i < params.size(); i++) {
+        if (code) {
+            env->setSlot(code->paramSlots[i], args[i]);
+        } else {
+            env->bind(params[i], boxed(context, args[i]));
+        }
+    }
+
+    // bind default parameters when not specified
+    for (auto item : paramsWithDefault) {
+        if (kwArgs && kwArgs->count(item.first)) {
+            env->bind(item.first, (*kwArgs)[item.first]);
+        } else {
+            env->bind(item.first, item.second);
+        }
+    }
+    if (hasVarKeywordArgs) {
+        auto kwArgsDict = context->newDictionaryValue();
+        if (kwArgs) {
+            for (const auto &arg : *kwArgs) {
+                kwArgsDict->set(arg.first, arg.second);
+            }
+        }
+        env->bind(varKeywordArgsParam, kwArgsDict);
+    }
+    if (hasVarArgs) {
+        auto varArgs = context->newArrayValue(env);
+        if (args.size() > params.size()) {
+            for (size_t i = params.size(); i < args.size(); i++) {
+                varArgs->push(args[i]);
+            }
+        }
+        env->bind(varArgsParam, varArgs);
+    }
+    return true;
+}
+
+bool UserFunctionValue::bindArguments(Environment *env, const vector<Value *> &args,
+                                      unordered_map<Symbol, Value *> *kwArgs) const {
+    return bindArgumentList(env, args, kwArgs);
+}
+
+bool UserFunctionValue::bindArguments(Environment *env, const vector<Word> &args,
+                                      unordered_map<Symbol, Value *> *kwArgs) const {
+    return bindArgumentList(env, args, kwArgs);
+}
+
 Value *UserFunctionValue::apply(const vector<Value *> &argsIn,
-                                Environment *caller, unordered_map<wstring, Value *> *kwargsIn) const {
-    Value *bodyReturnValue = nullptr;
-    Environment *env;
-    env = parentEnv->newChildEnvironment();
-    env->caller = caller;
+                                Environment *caller, unordered_map<Symbol, Value *> *kwargsIn) const {
+    Context *context = parentEnv->context;
+    if (context->completion.status == Completion::ERROR ||
+        !context->enterCall(caller ? caller : parentEnv)) {
+        return context->newNoneValue();
+    }
+    Value *result = call(argsIn, caller, kwargsIn);
+    context->leaveCall();
+    return result;
+}
+
+// Tail calls made by the body come back here as a Completion and are run by
+// the same loop, so a chain of them never nests applies. The frame is reused
+// when the function calls itself.
+Value *UserFunctionValue::call(const vector<Value *> &argsIn,
+                               Environment *caller, unordered_map<Symbol, Value *> *kwargsIn) const {
+    Context *context = parentEnv->context;
     vector<Value *> args;
     args.insert(args.end(), argsIn.begin(), argsIn.end());
-    unordered_map<wstring, Value *> kwArgsStatic;
+    unordered_map<Symbol, Value *> kwArgsStatic;
     if (kwargsIn != nullptr) {
         kwArgsStatic = *kwargsIn;
     }
-    unordered_map<wstring, Value *> *kwArgs = (kwargsIn == nullptr) ? nullptr : (&kwArgsStatic);
-    do {
-        if (bodyReturnValue != nullptr) {
-            delete bodyReturnValue;
+    unordered_map<Symbol, Value *> *kwArgs = (kwargsIn == nullptr) ? nullptr : (&kwArgsStatic);
+    // The running function, which only the loop may still refer to.
+    const UserFunctionValue *function = this;
+    RootScope roots(context);
+    roots.push(const_cast<UserFunctionValue *>(function));
+    Environment *env = nullptr;
+    bool dropResult = false;
+    while (true) {
+        if (env == nullptr) {
+            env = function->parentEnv->newChildEnvironment();
+            env->caller = caller;
+            if (function->code) {
+                env->enterFrame(function->code);
+            }
         }
-
-        if (params.size() > argsIn.size()) {
-            // TODO: also log original function name
-            ConsoleLogger().log("エラー：引数は足りません　")
-                    ->log("必要は")->logLong((long) params.size())
-                    ->log(" 渡したのは")->logLong((long) argsIn.size())
-                    ->logEndl();
-            return env->context->newNoneValue();
+        if (!function->bindArguments(env, args, kwArgs)) {
+            return context->newNoneValue();
         }
-
-        // bind normal params
-        for (size_t i = 0; i < params.size(); i++) {
-            env->bind(params[i], args[i]);
+        Value *result;
+        if (function->code) {
+            result = VM(context).run(function->code.get(), env, function);
+        } else {
+            result = env->eval(function->body, TailPosition::LAST);
+        }
+        if (result == Context::unwindSignal() &&
+            context->completion.status == Completion::ERROR) {
+            return context->newNoneValue();
+        }
+        if (result != Context::unwindSignal() ||
+            context->completion.status != Completion::TAIL_CALL) {
+            result = context->completedValue(result);
+            return dropResult ? context->newNoneValue() : result;
         }
 
-        // bind default parameters when not specified
-        for (auto item : paramsWithDefault) {
-            wstring left = item.first;
-            if (kwArgs && kwArgs->count(item.first)) {
-                env->bind(item.first, (*kwArgs)[item.first]);
-            } else {
-                env->bind(item.first, item.second);
-            }
+        // Take over the pending arguments, leaving our old storage behind
+        // for the next tail call.
+        Completion &completion = context->completion;
+        completion.status = Completion::NORMAL;
+        dropResult = dropResult || completion.dropResult;
+        args.swap(completion.args);
+        completion.args.clear();
+        if (completion.kwArgs.empty()) {
+            kwArgs = nullptr;
+        } else {
+            kwArgsStatic.swap(completion.kwArgs);
+            completion.kwArgs.clear();
+            kwArgs = &kwArgsStatic;
         }
-        if (hasVarKeywordArgs) {
-            auto kwArgsDict = env->context->newDictionaryValue();
-            if (kwArgs) {
-                for (const auto &arg : *kwArgs) {
-                    kwArgsDict->set(arg.first, arg.second);
-                }
-            }
-            env->bind(varKeywordArgsParam, kwArgsDict);
-        }
-        if (hasVarArgs) {
-            auto varArgs = env->context->newArrayValue(env);
-            if (argsIn.size() > params.size()) {
-                for (size_t i = params.size(); i < argsIn.size(); i++) {
-                    varArgs->push(argsIn[i]);
-                }
-            }
-            env->bind(varArgsParam, varArgs);
-        }
-        bodyReturnValue = env->eval(body, this);
-        if (bodyReturnValue->type == ValueType::RETURN) {
-            auto inner = ((ReturnValue *) bodyReturnValue)->inner;
-            delete bodyReturnValue;
-            return inner;
-        }
-        if (bodyReturnValue->type == ValueType::TAIL_CALL) {
-            TailCallValue *tailCallValue = (TailCallValue *) bodyReturnValue;
-            args = tailCallValue->args;
-            if (tailCallValue->hasKwArgs) {
-                if (!kwArgs) {
-                    kwArgs = &kwArgsStatic;
-                }
-                kwArgs->clear();
-                *kwArgs = tailCallValue->kwArgs;
-            } else {
-                kwArgs = nullptr;
-            }
+        if (completion.function == function) {
             env->tailReset();
+        } else {
+            function = completion.function;
+            roots.replace(0, const_cast<UserFunctionValue *>(function));
+            env = nullptr;
         }
-    } while (bodyReturnValue->type == ValueType::TAIL_CALL);
-    return bodyReturnValue;
+        completion.function = nullptr;
+    }
 }
 
-void UserFunctionValue::setVarKeywordParam(wstring name) {
+void UserFunctionValue::setVarKeywordParam(Symbol name) {
     hasVarKeywordArgs = true;
     varKeywordArgsParam = std::move(name);
 }
 
-void UserFunctionValue::setVarParam(wstring name) {
+void UserFunctionValue::setVarParam(Symbol name) {
     hasVarArgs = true;
     varArgsParam = std::move(name);
 }
@@ -229,6 +473,54 @@ string ArrayValue::toString() const {
     return ss.str();
 }
 
+Value *ArrayValue::getIndex(long index) {
+    if ((size_t) index < value.size()) {
+        return context->box(value[index]);
+    }
+    return nullptr;
+}
+
+DictionaryValue *ArrayValue::getLookupSource(Environment *) {
+    return parent;
+}
+
+void ArrayValue::rememberSelf() {
+    context->remember(this);
+}
+
+void WordVector::reserve(size_t capacity) {
+    if (capacity <= allocated) {
+        return;
+    }
+    auto grown = new Word[capacity];
+    copy(begin(), end(), grown);
+    if (words != inlineWords) {
+        delete[] words;
+    }
+    words = grown;
+    allocated = capacity;
+}
+
+void WordVector::append(const Word *first, const Word *last) {
+    reserve(length + (last - first));
+    copy(first, last, words + length);
+    length += last - first;
+}
+
+void ArrayValue::recordGrowth(size_t oldHeapBytes) {
+    if (context && value.heapBytes() > oldHeapBytes) {
+        context->recordGrowth(value.heapBytes() - oldHeapBytes);
+    }
+}
+
+bool ArrayValue::equals(const Value *rhs) const {
+    return this == rhs;
+}
+
+size_t ArrayValue::memorySize() const {
+    return sizeof(ArrayValue) + value.heapBytes();
+}
+
 string ArrayValue::toStringJP() const {
     stringstream ss;
     ss << "配列〈長さ：" << length() << "〉";
@@ -236,7 +528,7 @@ string ArrayValue::toStringJP() const {
 }
 
 Value *BoundFunctionValue::apply(const vector<Value *> &args, Environment *env,
-                                 unordered_map<wstring, Value *> *kwargsIn) const {
+                                 unordered_map<Symbol, Value *> *kwargsIn) const {
     vector<Value *> newArgs;
     newArgs.push_back(jibun);
     newArgs.insert(newArgs.end(), args.begin(), args.end());
@@ -3,21 +3,30 @@
 #ifndef VALUE_H
 #define VALUE_H
 
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <unordered_map>
 
+#include "CompactString.h"
+#include "Symbol.h"
+
 class Environment;
 
+class Context;
+
 using namespace std;
 
 enum class ValueType {
-    NUM, NUM_FLOAT, FUNC, NONE, RETURN, STRING, TAIL_CALL, DICT, MODULE, ARRAY
+    NUM, NUM_FLOAT, FUNC, NONE, RETURN, STRING, DICT, MODULE, ARRAY
 };
 const string ValueTypeStrings[] = {
-        "NUM", "NUM_FLOAT", "FUNC", "NONE", "RETURN", "STRING", "TAIL_CALL", "DICT", "MODULE", "ARRAY"
+        "NUM", "NUM_FLOAT", "FUNC", "NONE", "RETURN", "STRING", "DICT", "MODULE", "ARRAY"
 };
+const size_t ValueTypeCount = sizeof(ValueTypeStrings) / sizeof(ValueTypeStrings[0]);
 
 class NumberValue;
 
@@ -48,8 +57,18 @@ public:
 
     virtual DictionaryValue *getLookupSource(Environment *env);
 
+    // Approximate heap footprint, used for collection budgeting.
+    virtual size_t memorySize() const { return sizeof(Value); }
+
     ValueType type;
     int refs = 0;
+    // Epoch of the last collection that found this value reachable.
+    uint32_t mark = 0;
+    // GC state, see Context. Objects not allocated through a Context
+    // (builtins, statics) are unmanaged and treated as old.
+    bool young = false;
+    bool remembered = false;
+    bool managed = false;
 };
 
 bool operator==(const Value &lhs, const Value &rhs);
@@ -67,6 +86,8 @@ public:
 
     DictionaryValue *getLookupSource(Environment *env) override;
 
+    size_t memorySize() const override { return sizeof(NumberValue); }
+
     long value;
 };
 
@@ -83,12 +104,161 @@ public:
 
     DictionaryValue *getLookupSource(Environment *env) override;
 
+    size_t memorySize() const override { return sizeof(FloatValue); }
+
     double value;
 };
 
+// Integers and floats mix in arithmetic, where they are computed as floats.
+inline bool isNumeric(const Value *value) {
+    return value->type == ValueType::NUM || value->type == ValueType::NUM_FLOAT;
+}
+
+inline double floatValueOf(const Value *value) {
+    if (value->type == ValueType::NUM_FLOAT) {
+        return ((const FloatValue *) value)->value;
+    }
+    return (double) ((const NumberValue *) value)->value;
+}
+
+// What ＝＝ compares: numbers by value whether integer or float, everything
+// else with Value::equals.
+bool valuesEqual(const Value *lhs, const Value *rhs);
+
+// A value in one 64-bit word, NaN boxed. Floats are stored as their own
+// bits, with every NaN folded into one. The other kinds live in the payload
+// of NaNs that are never stored as floats, told apart by the top 16 bits:
+// integers that fit in 48 bits, None, and pointers to Values, where a null
+// pointer stands for "unbound". Integers, floats and None held as words
+// are not allocated; Context::box makes a Value of a word for code that
+// needs one.
+//
+// Words made from a pointer keep that pointer, so roots stay roots; Word::of
+// also unpacks numbers and None into the word itself.
+class Word {
+    static const uint64_t TAG_MASK = 0xFFFF000000000000ULL;
+    static const uint64_t POINTER_TAG = 0xFFF9000000000000ULL;
+    static const uint64_t INT_TAG = 0xFFFA000000000000ULL;
+    static const uint64_t NONE_TAG = 0xFFFB000000000000ULL;
+    static const uint64_t PAYLOAD_MASK = 0x0000FFFFFFFFFFFFULL;
+    static const uint64_t CANONICAL_NAN = 0x7FF8000000000000ULL;
+
+    uint64_t bits;
+
+    explicit Word(uint64_t bits, bool) : bits(bits) {}
+
+public:
+    static const long INT_MIN_VALUE = -(1L << 47);
+    static const long INT_MAX_VALUE = (1L << 47) - 1;
+
+    Word() : bits(POINTER_TAG) {}
+
+    Word(Value *value) : bits(POINTER_TAG | (uint64_t) (uintptr_t) value) {}
+
+    static bool fitsInt(long number) {
+        return number >= INT_MIN_VALUE && number <= INT_MAX_VALUE;
+    }
+
+    // `number` must fit, see fitsInt.
+    static Word fromInt(long number) {
+        return Word(INT_TAG | ((uint64_t) number & PAYLOAD_MASK), true);
+    }
+
+    static Word fromFloat(double number) {
+        uint64_t result;
+        memcpy(&result, &number, sizeof(result));
+        return Word(number != number ? CANONICAL_NAN : result, true);
+    }
+
+    static Word none() { return Word(NONE_TAG, true); }
+
+    static Word of(Value *value) {
+        switch (value->type) {
+            case ValueType::NUM: {
+                long number = ((NumberValue *) value)->value;
+                return fitsInt(number) ? fromInt(number) : Word(value);
+            }
+            case ValueType::NUM_FLOAT:
+                return fromFloat(((FloatValue *) value)->value);
+            case ValueType::NONE:
+                return none();
+            default:
+                return Word(value);
+        }
+    }
+
+    bool isInt() const { return (bits & TAG_MASK) == INT_TAG; }
+
+    bool isFloat() const { return bits < POINTER_TAG; }
+
+    bool isNone() const { return bits == NONE_TAG; }
+
+    bool isPointer() const { return (bits & TAG_MASK) == POINTER_TAG; }
+
+    bool isNull() const { return bits == POINTER_TAG; }
+
+    long asInt() const { return (long) ((int64_t) (bits << 16) >> 16); }
+
+    double asFloat() const {
+        double result;
+        memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+
+    Value *asPointer() const { return (Value *) (uintptr_t) (bits & PAYLOAD_MASK); }
+
+    // Not valid for null words.
+    ValueType type() const {
+        if (isInt()) {
+            return ValueType::NUM;
+        } else if (isFloat()) {
+            return ValueType::NUM_FLOAT;
+        } else if (isNone()) {
+            return ValueType::NONE;
+        }
+        return asPointer()->type;
+    }
+
+    bool isTruthy() const {
+        if (isInt()) {
+            return asInt() != 0;
+        } else if (isFloat()) {
+            return asFloat() != 0;
+        }
+        return isNone() || asPointer()->isTruthy();
+    }
+
+    bool operator==(const Word &rhs) const { return bits == rhs.bits; }
+
+    bool operator!=(const Word &rhs) const { return bits != rhs.bits; }
+};
+
+inline bool isNumeric(Word word) {
+    return word.isInt() || word.isFloat() || (word.isPointer() && isNumeric(word.asPointer()));
+}
+
+// Integers too wide for a word are kept as NumberValue pointers.
+inline bool isInteger(Word word) {
+    return word.isInt() || (word.isPointer() && word.asPointer()->type == ValueType::NUM);
+}
+
+// `word` must be an integer, see isInteger.
+inline long integerValueOf(Word word) {
+    return word.isInt() ? word.asInt() : ((const NumberValue *) word.asPointer())->value;
+}
+
+inline double floatValueOf(Word word) {
+    if (word.isFloat()) {
+        return word.asFloat();
+    } else if (word.isInt()) {
+        return (double) word.asInt();
+    }
+    return floatValueOf(word.asPointer());
+}
+
 class StringValue : public Value {
 public:
-    explicit StringValue(wstring str) : Value(ValueType::STRING), value(std::move(str)) {};
+    explicit StringValue(CompactString str) : Value(ValueType::STRING), value(std::move(str)) {};
 
     bool equals(const Value *rhs) const override;
 
@@ -97,91 +267,330 @@ public:
 
     DictionaryValue *getLookupSource(Environment *env) override;
 
-    wstring value;
+    size_t memorySize() const override;
+
+    CompactString value;
+};
+
+// Layout shared by the dictionaries that were given the same keys in the
+// same order (a hidden class). Adding a key moves a dictionary along a
+// transition to the child shape for that key, so dictionaries built the
+// same way end up sharing one Shape.
+class Shape {
+    unordered_map<Symbol, unique_ptr<Shape>> transitions;
+
+public:
+    static const uint32_t NOT_FOUND = UINT32_MAX;
+    // Dictionaries with more keys, or shapes with more transitions, are
+    // treated as maps rather than records.
+    static const size_t MAX_KEYS = 64;
+    static const size_t MAX_TRANSITIONS = 64;
+
+    vector<Symbol> keys;
+    unordered_map<Symbol, uint32_t> slots;
+
+    uint32_t find(Symbol key) const {
+        auto slot = slots.find(key);
+        return slot == slots.end() ? NOT_FOUND : slot->second;
+    }
+
+    // The shape with `key` appended, or nullptr past the limits.
+    Shape *add(Symbol key);
+};
+
+// Remembers where a property access site last found its key, for up to
+// ENTRIES receiver shapes. An entry either names a slot of the receiver
+// itself, or a slot of its parent (`holder`) for methods found on a
+// prototype.
+struct PropertyCache {
+    static const size_t ENTRIES = 4;
+
+    struct Entry {
+        const Shape *shape;
+        const void *holder;
+        const Shape *holderShape;
+        uint32_t slot;
+    };
+
+    Entry entries[ENTRIES];
+    size_t count = 0;
+    size_t next = 0;
+
+    void record(const Entry &entry) {
+        if (count < ENTRIES) {
+            entries[count++] = entry;
+        } else {
+            entries[next++ % ENTRIES] = entry;
+        }
+    }
 };
 
 class DictionaryValue : public Value {
+    // Values live in `slots` laid out by `shape`. A dictionary used as a map
+    // (too many keys, or keys computed at run time) drops its shape and
+    // keeps everything in `table` instead. Keys computed at run time that
+    // are not already Symbols go in `entries`, so they are not interned.
+    Shape *shape;
+    vector<Value *> slots;
+    unordered_map<Symbol, Value *> table;
+    unordered_map<CompactString, Value *> entries;
+
+    void convertToTable();
+
+    Value *findEntry(const CompactString &key) const {
+        auto entry = entries.find(key);
+        return entry == entries.end() ? nullptr : entry->second;
+    }
 
 public:
-    DictionaryValue();
+    explicit DictionaryValue(Shape *shape);
 
-    unordered_map<wstring, Value *> value;
     DictionaryValue *parent = nullptr;
+    // Owning context for the write barrier, null when not GC managed.
+    Context *context = nullptr;
 
-    void setParent(DictionaryValue *p) { parent = p; }
+    void setParent(DictionaryValue *p) {
+        parent = p;
+        writeBarrier(p);
+    }
 
     DictionaryValue *getLookupSource(Environment *env) override;
 
-    void set(const wstring &name, Value *v) { value[name] = v; }
+    void set(Symbol name, Value *v);
+
+    // Stores under a key computed at run time, which marks the dictionary
+    // as a map.
+    void setEntry(Symbol name, Value *v);
+
+    void setEntry(const CompactString &key, Value *v);
+
+    // Must be called after storing a reference to `v` in this object.
+    void writeBarrier(Value *v) {
+        if (v && v->young && !young && !remembered && context) {
+            rememberSelf();
+        }
+    }
+
+    void rememberSelf();
 
-    virtual Value *get(const wstring &name) {
-        if (value.count(name)) {
-            return value[name];
-        } else if (parent) {
-            return parent->get(name);
+    // Own value for `name`, or nullptr.
+    Value *getOwn(Symbol name) const {
+        if (shape) {
+            auto slot = shape->find(name);
+            return slot == Shape::NOT_FOUND ? nullptr : slots[slot];
+        }
+        auto entry = table.find(name);
+        if (entry != table.end()) {
+            return entry->second;
+        }
+        // The key may have been stored before it became a Symbol.
+        return entries.empty() ? nullptr : findEntry(name.name());
+    }
+
+    // Own value for a key computed at run time, or nullptr.
+    Value *getOwnEntry(const CompactString &key) const;
+
+    // Value for `name` here or up the parent chain, or nullptr.
+    Value *get(Symbol name) {
+        for (auto dictionary = this; dictionary; dictionary = dictionary->parent) {
+            if (auto result = dictionary->getOwn(name)) {
+                return result;
+            }
         }
         return nullptr;
     }
 
-    virtual bool has(const wstring &name) {
-        return value.count(name) || (parent && parent->has(name));
+    // Same as get, consulting and filling a call site's cache.
+    Value *get(Symbol name, PropertyCache &cache);
+
+    // Same as get for a key computed at run time, which is not interned.
+    Value *getEntry(const CompactString &key);
+
+    virtual bool has(Symbol name) {
+        return get(name) != nullptr;
+    }
+
+    size_t size() const { return shape ? slots.size() : table.size() + entries.size(); }
+
+    // Own keys, in insertion order unless the dictionary became a map.
+    vector<CompactString> keys() const;
+
+    template<typename F>
+    void forEachValue(F f) const {
+        for (auto value : slots) {
+            f(value);
+        }
+        for (const auto &entry : table) {
+            f(entry.second);
+        }
+        for (const auto &entry : entries) {
+            f(entry.second);
+        }
     }
 
     bool equals(const Value *rhs) const override;
 
+    size_t memorySize() const override;
+
     string toString() const override;
     string toStringJP() const override;
 };
 
 
-class ArrayValue : public DictionaryValue {
+// Elements of an array: a length and capacity header followed by room for
+// a few words in place, so that small arrays such as the キー、値 pairs of
+// マップ need no buffer of their own. Past that the words move to the heap.
+// Supports the parts of the vector interface that arrays use.
+class WordVector {
 public:
-    vector<Value *> value;
+    static const uint32_t INLINE_CAPACITY = 2;
+
+    WordVector() = default;
+
+    WordVector(const WordVector &) = delete;
 
-    explicit ArrayValue() {
-        type = ValueType::ARRAY;
-        parent = nullptr;
+    WordVector &operator=(const WordVector &) = delete;
+
+    ~WordVector() {
+        if (words != inlineWords) {
+            delete[] words;
+        }
     }
 
-    void set(long index, Value *v) { value[index] = v; }
+    size_t size() const { return length; }
+
+    size_t capacity() const { return allocated; }
 
-    bool has(const wstring &name) override {
-        return (parent && parent->has(name));
+    bool empty() const { return length == 0; }
+
+    // Bytes of the heap buffer, zero while the words are in place.
+    size_t heapBytes() const {
+        return words == inlineWords ? 0 : allocated * sizeof(Word);
     }
 
-    void push(Value *v) { value.push_back(v); }
+    Word &operator[](size_t index) { return words[index]; }
+
+    const Word &operator[](size_t index) const { return words[index]; }
+
+    Word &back() { return words[length - 1]; }
+
+    const Word &back() const { return words[length - 1]; }
+
+    Word *begin() { return words; }
+
+    Word *end() { return words + length; }
 
-    Value *getIndex(long index) {
-        if ((size_t) index < value.size()) {
-            return value[index];
+    const Word *begin() const { return words; }
+
+    const Word *end() const { return words + length; }
+
+    void reserve(size_t capacity);
+
+    void push_back(Word word) {
+        if (length == allocated) {
+            reserve(2 * allocated);
         }
-        return nullptr;
+        words[length++] = word;
     }
 
-    long length() const {
-        return value.size();
-    }
+    void append(const Word *first, const Word *last);
 
-    string toString() const override;
-    string toStringJP() const override;
+private:
+    uint32_t length = 0;
+    uint32_t allocated = INLINE_CAPACITY;
+    Word *words = inlineWords;
+    Word inlineWords[INLINE_CAPACITY];
 };
 
-// Indicates that an expression should force exit of func body eval.
-class ReturnValue : public Value {
+// A list of words. Arrays have no keys of their own, so unlike
+// dictionaries they carry no shape or table: member lookups go straight to
+// `parent`, the array type 配列型 unless 親設定する gave it another.
+// ArrayValue is no longer a DictionaryValue, and `value` holds words rather
+// than Value pointers; code written against the old layout should use
+// length, getIndex, set and push, which keep their old signatures.
+class ArrayValue : public Value {
 public:
-    Value *inner;
+    // Elements as words, so arrays of numbers hold no NumberValues.
+    WordVector value;
+    DictionaryValue *parent = nullptr;
+    // Owning context for the write barrier, null when not GC managed.
+    Context *context = nullptr;
 
-    explicit ReturnValue(Value *inner) : Value(ValueType::RETURN), inner(inner) {};
-};
+    ArrayValue() : Value(ValueType::ARRAY) {}
 
-class TailCallValue : public Value {
-public:
-    vector<Value *> args;
-    bool hasKwArgs = false;
-    unordered_map<wstring, Value *> kwArgs;
+    void setParent(DictionaryValue *p) {
+        parent = p;
+        writeBarrier(p);
+    }
 
-    explicit TailCallValue(vector<Value *> _args)
-            : Value(ValueType::TAIL_CALL), args(std::move(_args)) {};
+    DictionaryValue *getLookupSource(Environment *env) override;
+
+    void set(long index, Word v) {
+        value[index] = v;
+        writeBarrier(v);
+    }
+
+    void set(long index, Value *v) {
+        set(index, Word::of(v));
+    }
+
+    // Member `name` of the array's type, or nullptr.
+    Value *get(Symbol name) {
+        return parent ? parent->get(name) : nullptr;
+    }
+
+    bool has(Symbol name) {
+        return parent && parent->has(name);
+    }
+
+    void push(Word v) {
+        size_t heapBytes = value.heapBytes();
+        value.push_back(v);
+        if (value.heapBytes() != heapBytes) {
+            recordGrowth(heapBytes);
+        }
+        writeBarrier(v);
+    }
+
+    void push(Value *v) {
+        push(Word::of(v));
+    }
+
+    // Must be called after storing a reference to `v` in this object.
+    void writeBarrier(Value *v) {
+        if (v && v->young && !young && !remembered && context) {
+            rememberSelf();
+        }
+    }
+
+    void writeBarrier(Word v) {
+        if (v.isPointer()) {
+            writeBarrier(v.asPointer());
+        }
+    }
+
+    void rememberSelf();
+
+    // Charges the growth of the elements' heap buffer past `oldHeapBytes`
+    // to the collector; call after growing `value` directly.
+    void recordGrowth(size_t oldHeapBytes);
+
+    // The element boxed as a Value, or nullptr outside the array. With
+    // set and push taking a Value, this is the stable way for builtins and
+    // extensions to reach elements; `value` may change representation. A
+    // boxed number is a new young value, so root it like any allocation.
+    Value *getIndex(long index);
+
+    long length() const {
+        return value.size();
+    }
+
+    bool equals(const Value *rhs) const override;
+
+    size_t memorySize() const override;
+
+    string toString() const override;
+    string toStringJP() const override;
 };
 
 enum class FunctionValueType {
@@ -193,7 +602,7 @@ public:
     FunctionValue() : Value(ValueType::FUNC) {};
 
     virtual Value *apply(const vector<Value *> &args, Environment *env,
-                         unordered_map<wstring, Value *> *kwargsIn = nullptr) const = 0;
+                         unordered_map<Symbol, Value *> *kwargsIn = nullptr) const = 0;
 
     FunctionValueType functionType = FunctionValueType::NONE;
 
@@ -204,23 +613,32 @@ public:
 
 class SyntaxNode;
 
+class Code;
+
 class UserFunctionValue : public FunctionValue {
-    vector<wstring> params;
-    unordered_map<wstring, Value *> paramsWithDefault;
+    vector<Symbol> params;
+    unordered_map<Symbol, Value *> paramsWithDefault;
     bool hasVarKeywordArgs;
-    wstring varKeywordArgsParam;
+    Symbol varKeywordArgsParam;
     bool hasVarArgs{};
-    wstring varArgsParam;
+    Symbol varArgsParam;
     SyntaxNode *body;
+
+    Value *call(const vector<Value *> &args, Environment *caller,
+                unordered_map<Symbol, Value *> *kwargsIn) const;
+
+    template<typename Argument>
+    bool bindArgumentList(Environment *env, const vector<Argument> &args,
+                          unordered_map<Symbol, Value *> *kwArgs) const;
 public:
-    UserFunctionValue(vector<wstring> params, SyntaxNode *body,
+    UserFunctionValue(vector<Symbol> params, SyntaxNode *body,
                       Environment *parentEnv)
             : FunctionValue(), params(std::move(params)), hasVarKeywordArgs(false), body(body),
               parentEnv(parentEnv) {
         functionType = FunctionValueType::USER_FUNCTION;
     };
 
-    UserFunctionValue(vector<wstring> params, unordered_map<wstring, Value *> paramsWithDefault,
+    UserFunctionValue(vector<Symbol> params, unordered_map<Symbol, Value *> paramsWithDefault,
                       SyntaxNode *body, Environment *parentEnv)
             : FunctionValue(), params(std::move(params)), paramsWithDefault(std::move(paramsWithDefault)),
               hasVarKeywordArgs(false), body(body), parentEnv(parentEnv) {
@@ -228,27 +646,39 @@ public:
     };
 
     Environment *parentEnv;
+    // Compiled body when created by the VM.
+    shared_ptr<const Code> code;
 
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *kwargsIn = nullptr) const override;
+                 unordered_map<Symbol, Value *> *kwargsIn = nullptr) const override;
+
+    // Binds a call's arguments into the fresh or reset frame `env`; false
+    // when too few were given.
+    bool bindArguments(Environment *env, const vector<Value *> &args,
+                       unordered_map<Symbol, Value *> *kwArgs) const;
+
+    bool bindArguments(Environment *env, const vector<Word> &args,
+                       unordered_map<Symbol, Value *> *kwArgs) const;
 
     string toString() const override;
 
-    const unordered_map<wstring, Value *> &getParamsWithDefault() {
+    size_t memorySize() const override;
+
+    const unordered_map<Symbol, Value *> &getParamsWithDefault() {
         return paramsWithDefault;
     }
 
-    void setVarKeywordParam(wstring name);
+    void setVarKeywordParam(Symbol name);
 
     bool hasVarKeywordParam() const { return hasVarKeywordArgs; };
 
-    const wstring getVarKeywordParam() const { return varKeywordArgsParam; };
+    Symbol getVarKeywordParam() const { return varKeywordArgsParam; };
 
-    void setVarParam(wstring name);
+    void setVarParam(Symbol name);
 
     bool hasVarParam() const { return hasVarArgs; };
 
-    const wstring getVarParam() const { return varArgsParam; };
+    Symbol getVarParam() const { return varArgsParam; };
 };
 
 class BoundFunctionValue : public FunctionValue {
@@ -262,7 +692,9 @@ public:
     };
 
     Value *apply(const vector<Value *> &args, Environment *env,
-                 unordered_map<wstring, Value *> *kwargsIn = nullptr) const override;
+                 unordered_map<Symbol, Value *> *kwargsIn = nullptr) const override;
+
+    size_t memorySize() const override { return sizeof(BoundFunctionValue); }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+#include "Allocator.h"
+
+struct Counted {
+    static int destroyed;
+    long payload[3];
+
+    ~Counted() { destroyed++; }
+};
+
+int Counted::destroyed = 0;
+
+static void destroyCounted(void *slot) {
+    ((Counted *) slot)->~Counted();
+}
+
+TEST(slabPool, releasedSlotsAreReused) {
+    SlabPool pool(sizeof(Counted), destroyCounted);
+    Counted::destroyed = 0;
+    void *first = pool.allocate();
+    new(first) Counted();
+    EXPECT_EQ(Slab::of(first), Slab::of(pool.allocate()));
+    EXPECT_EQ((size_t) 2, pool.getLiveCount());
+
+    SlabPool::release(first);
+    EXPECT_EQ(1, Counted::destroyed);
+    EXPECT_EQ((size_t) 1, pool.getLiveCount());
+    EXPECT_EQ(first, pool.allocate());
+}
+
+TEST(slabPool, sweepReleasesDeadObjectsAndEmptySlabs) {
+    SlabPool pool(sizeof(Counted), destroyCounted);
+    Counted::destroyed = 0;
+    vector<Counted *> objects;
+    for (int i = 0; i < 10000; i++) {
+        auto object = new(pool.allocate()) Counted();
+        object->payload[0] = i;
+        objects.push_back(object);
+    }
+    EXPECT_GT(pool.getSlabCount(), (size_t) 1);
+
+    pool.sweep([](void *slot) { return ((Counted *) slot)->payload[0] != 0; });
+
+    EXPECT_EQ(9999, Counted::destroyed);
+    EXPECT_EQ((size_t) 1, pool.getLiveCount());
+    EXPECT_EQ((size_t) 1, pool.getSlabCount());
+    EXPECT_EQ(0, objects[0]->payload[0]);
+
+    pool.clear();
+    EXPECT_EQ(10000, Counted::destroyed);
+    EXPECT_EQ((size_t) 0, pool.getSlabCount());
+}
+
+static bool payloadIsOdd(void *slot, void *) {
+    return ((Counted *) slot)->payload[0] % 2 == 1;
+}
+
+TEST(slabPool, lazySweepFreesOneSlabPerExhaustedFreeList) {
+    SlabPool pool(sizeof(Counted), destroyCounted);
+    Counted::destroyed = 0;
+    for (int i = 0; i < 10000; i++) {
+        auto object = new(pool.allocate()) Counted();
+        object->payload[0] = i;
+    }
+    auto slabCount = pool.getSlabCount();
+
+    pool.sweepLazily(payloadIsOdd, nullptr);
+    EXPECT_TRUE(pool.isSweeping());
+    EXPECT_EQ(0, Counted::destroyed);
+
+    void *first = pool.allocate();
+    EXPECT_GT(Counted::destroyed, 0);
+    EXPECT_LT(Counted::destroyed, 5000);
+    EXPECT_EQ(Slab::of(first), Slab::of(pool.allocate()));
+
+    while (pool.sweepNext()) {
+    }
+    EXPECT_FALSE(pool.isSweeping());
+    EXPECT_EQ(5000, Counted::destroyed);
+    EXPECT_EQ((size_t) 5002, pool.getLiveCount());
+    EXPECT_EQ(slabCount, pool.getSlabCount());
+    pool.clear();
+}
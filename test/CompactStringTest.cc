@@ -0,0 +1,60 @@
+#include "gtest/gtest.h"
+#include "CompactString.h"
+#include "Tokenizer.h"
+
+TEST(compactString, usesTheNarrowestWidth) {
+    EXPECT_EQ((size_t) 1, CompactString(L"tanuki").width());
+    EXPECT_EQ((size_t) 1, CompactString(L"café").width());
+    EXPECT_EQ((size_t) 2, CompactString(L"狸の語").width());
+    // A UTF-16 wchar_t holds characters past the BMP as surrogate pairs.
+    EXPECT_EQ(sizeof(wchar_t) == 4 ? (size_t) 4 : (size_t) 2, CompactString(L"狸\U0001F99D").width());
+
+    CompactString japanese(L"狸の語");
+    EXPECT_EQ((size_t) 3, japanese.length());
+    EXPECT_EQ(L'の', japanese[1]);
+    EXPECT_EQ(L"狸の語", japanese.toWString());
+}
+
+TEST(compactString, concatenationAndSlicesKeepTheWidthCanonical) {
+    CompactString joined = CompactString(L"abc") + CompactString(L"狸");
+    EXPECT_EQ((size_t) 2, joined.width());
+    EXPECT_EQ(L"abc狸", joined);
+
+    CompactString slice = joined.substr(0, 3);
+    EXPECT_EQ((size_t) 1, slice.width());
+    EXPECT_EQ(CompactString(L"abc"), slice);
+    EXPECT_EQ(slice.hash(), CompactString(L"abc").hash());
+    EXPECT_NE(CompactString(L"abd"), slice);
+    EXPECT_EQ(L"狸", joined.substr(3, 10));
+    EXPECT_TRUE(joined.substr(4, 1).empty());
+}
+
+TEST(compactString, encodesUTF8Directly) {
+    for (const wstring &text : {wstring(L"ascii"), wstring(L"café"),
+                                wstring(L"こんにちは"), wstring(L"狸\U0001F99D")}) {
+        EXPECT_EQ(encodeUTF8(text), CompactString(text).toUTF8());
+    }
+}
+
+TEST(compactString, appendsShareTheLeftBufferWithoutChangingIt) {
+    CompactString base(L"狸");
+    CompactString first = base + CompactString(L"語");
+    // base no longer ends its buffer, so this one copies.
+    CompactString second = base + CompactString(L"です");
+    CompactString widened = first + CompactString(L"\U0001F99D");
+    CompactString doubled = first + first;
+
+    EXPECT_EQ(L"狸", base);
+    EXPECT_EQ(L"狸語", first);
+    EXPECT_EQ(L"狸です", second);
+    EXPECT_EQ(L"狸語\U0001F99D", widened);
+    EXPECT_EQ(L"狸語狸語", doubled);
+    EXPECT_EQ(L"狸語狸語a", doubled + CompactString(L"a"));
+
+    CompactString built;
+    for (int i = 0; i < 1000; i++) {
+        built = built + CompactString(L"ab");
+    }
+    EXPECT_EQ((size_t) 2000, built.length());
+    EXPECT_EQ(L'b', built[1999]);
+}
@@ -0,0 +1,458 @@
+#include "gtest/gtest.h"
+#include "Tokenizer.h"
+#include "Parser.h"
+#include "Environment.h"
+#include "Context.h"
+
+TEST(context, allocationLightCodeDoesNotCollect) {
+    auto stringInput = StringInputSource(
+            L"関数、ループ（回数）\n"
+            L"　もし、回数＝＝０\n"
+            L"　　返す、０\n"
+            L"　返す、ループ（回数－１）\n"
+            L"ループ（１００）\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+
+    Context context;
+    auto *env = new Environment(&context);
+    env->eval(tree);
+
+    EXPECT_EQ(0, context.getCollectionCount());
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(context, allocationHeavyCodeCollects) {
+    auto stringInput = StringInputSource(
+            L"関数、ループ（回数）\n"
+            L"　結果＝「」\n"
+            L"　関数、中（文字）\n"
+            L"　　外側、結果\n"
+            L"　　結果＝結果＋文字\n"
+            L"　それぞれ（「あいうえおかきくけこさしすせそ」、中）\n"
+            L"　もし、回数＝＝０\n"
+            L"　　返す、結果\n"
+            L"　返す、ループ（回数－１）\n"
+            L"ループ（２００）\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+
+    Context context;
+    context.setMinimumHeap(16 * 1024);
+    auto *env = new Environment(&context);
+    env->eval(tree);
+
+    EXPECT_GT(context.getCollectionCount(), 0);
+    EXPECT_LT(context.getBytesSinceCollection(), (size_t) 32 * 1024);
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(context, minorCollectionKeepsValuesStoredInOldObjects) {
+    Context context;
+    context.setFrequency(1);
+    auto *env = new Environment(&context);
+    auto dictionary = context.newDictionaryValue();
+    env->bind(L"辞書", dictionary);
+    context.collect(env);
+    EXPECT_FALSE(dictionary->young);
+
+    dictionary->set(L"あ", context.newStringValue(L"若い"));
+    EXPECT_TRUE(dictionary->remembered);
+    context.collect(env);
+
+    EXPECT_EQ(2, context.getMinorCollectionCount());
+    EXPECT_FALSE(dictionary->remembered);
+    auto value = dictionary->get(L"あ");
+    EXPECT_FALSE(value->young);
+    EXPECT_EQ(L"若い", value->toStringValue()->value);
+
+    context.cleanup();
+}
+
+TEST(context, minorCollectionFreesOnlyYoungGarbage) {
+    auto stringInput = StringInputSource(
+            L"関数、ループ（回数）\n"
+            L"　ゴミ＝「ゴミ」＋「ゴミ」\n"
+            L"　もし、回数＝＝０\n"
+            L"　　返す、０\n"
+            L"　返す、ループ（回数－１）\n"
+            L"ループ（２００）\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+
+    Context context;
+    context.setNurserySize(4 * 1024);
+    auto *env = new Environment(&context);
+    env->eval(tree);
+
+    EXPECT_GT(context.getMinorCollectionCount(), 0);
+    EXPECT_EQ(context.getMinorCollectionCount(), context.getCollectionCount());
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(context, markingSurvivesLongLinkedList) {
+    const long length = 1000000;
+    Context context;
+    context.setFrequency(1);
+    auto *env = new Environment(&context);
+
+    // Same shape as 連結リスト in core.pin: 初め -> {内容, 次} -> ...
+    auto listClass = context.newDictionaryValue();
+    auto list = context.newDictionaryValue();
+    list->setParent(listClass);
+    Value *next = Context::newNoneValue();
+    for (long i = length - 1; i >= 0; i--) {
+        auto node = context.newDictionaryValue();
+        node->set(L"内容", context.newNumberValue(i));
+        node->set(L"次", next);
+        next = node;
+    }
+    list->set(L"初め", next);
+    env->bind(L"連結リスト", listClass);
+    env->bind(L"リスト", list);
+
+    // The minor collection promotes the whole list, which exceeds the budget
+    // and triggers a full collection over it as well.
+    context.collect(env);
+    EXPECT_GT(context.getCollectionCount(), context.getMinorCollectionCount());
+
+    long count = 0;
+    for (auto node = list->get(L"初め"); node->type == ValueType::DICT;
+         node = node->toDictionaryValue()->get(L"次")) {
+        EXPECT_EQ(count, node->toDictionaryValue()->get(L"内容")->toNumberValue()->value);
+        count++;
+    }
+    EXPECT_EQ(length, count);
+
+    context.cleanup();
+}
+
+static size_t liveBytesAfterFullCollection(unsigned markThreads) {
+    Context context;
+    context.setFrequency(1);
+    context.setMinimumHeap(1024);
+    context.setMarkThreads(markThreads);
+    auto *env = new Environment(&context);
+
+    auto table = context.newArrayValue(env);
+    for (long i = 0; i < 2000; i++) {
+        auto row = context.newDictionaryValue();
+        for (long j = 0; j < 50; j++) {
+            row->set(to_wstring(j), context.newStringValue(to_wstring(i * j)));
+        }
+        table->push(row);
+        context.newStringValue(L"ゴミ");
+    }
+    env->bind(L"表", table);
+    context.collect(env);
+    EXPECT_GT(context.getCollectionCount(), context.getMinorCollectionCount());
+
+    EXPECT_EQ(2000, (long) table->value.size());
+    auto last = table->value.back().asPointer()->toDictionaryValue();
+    EXPECT_EQ(L"97951", last->get(L"49")->toStringValue()->value);
+    auto liveBytes = context.getLiveBytes();
+    context.cleanup();
+    return liveBytes;
+}
+
+TEST(context, parallelMarkingFindsTheSameLiveObjects) {
+    auto serial = liveBytesAfterFullCollection(1);
+    EXPECT_GT(serial, (size_t) 0);
+    EXPECT_EQ(serial, liveBytesAfterFullCollection(4));
+}
+
+TEST(context, onlySmallNumbersAreShared) {
+    Context context;
+    EXPECT_EQ(context.newNumberValue(-1), context.newNumberValue(-1));
+    EXPECT_EQ(context.newNumberValue(1000), context.newNumberValue(1000));
+    EXPECT_NE(context.newNumberValue(1000000), context.newNumberValue(1000000));
+    context.cleanup();
+}
+
+TEST(context, growingArraysCountTowardsCollection) {
+    Context context;
+    context.setNurserySize(16 * 1024);
+    auto *env = new Environment(&context);
+    auto array = context.newArrayValue(env);
+    size_t before = context.getBytesSinceCollection();
+    for (long i = 0; i < 10000; i++) {
+        array->push(Word::fromInt(i));
+    }
+    // The array was charged only its header when made; its elements are
+    // charged as the buffer grows.
+    EXPECT_GE(context.getBytesSinceCollection() - before, 10000 * sizeof(Word));
+
+    before = context.getBytesSinceCollection();
+    env->add(array, array);
+    EXPECT_GE(context.getBytesSinceCollection() - before, 20000 * sizeof(Word));
+
+    context.collect(env);
+    EXPECT_EQ(1, context.getCollectionCount());
+
+    context.cleanup();
+}
+
+TEST(context, smallArraysKeepTheirElementsInPlace) {
+    Context context;
+    auto *env = new Environment(&context);
+    auto pair = context.newArrayValue(env);
+    auto key = context.newStringValue(L"キー");
+    size_t before = context.getBytesSinceCollection();
+    pair->push(key);
+    pair->push(Word::fromInt(2000));
+    // A pair needs no buffer of its own.
+    EXPECT_EQ(before, context.getBytesSinceCollection());
+    EXPECT_EQ(sizeof(ArrayValue), pair->memorySize());
+
+    pair->push(Word::fromInt(3000));
+    EXPECT_GT(pair->memorySize(), sizeof(ArrayValue));
+    EXPECT_EQ(L"キー", pair->getIndex(0)->toStringValue()->value);
+    EXPECT_EQ(2000, pair->getIndex(1)->toNumberValue()->value);
+    EXPECT_EQ(3000, pair->getIndex(2)->toNumberValue()->value);
+
+    context.cleanup();
+}
+
+TEST(context, allocationElsewhereSweepsDeadArrays) {
+    Context context;
+    context.setGrowthFactor(1);
+    context.setMinimumHeap(0);
+    context.setFrequency(1);
+    auto *env = new Environment(&context);
+    auto holder = context.newArrayValue(env);
+    env->bind(L"配列", holder);
+    for (long i = 0; i < 5000; i++) {
+        holder->push(context.newArrayValue(env));
+    }
+    context.collect(env);
+    env->bind(L"配列", context.newNumberValue(0));
+    context.collect(env);
+    size_t heapBefore = context.getStats().heapBytes;
+
+    // No more arrays are made, so only the paced sweep can reach them.
+    for (long i = 0; i < 2000; i++) {
+        context.newStringValue(L"ゴミ");
+    }
+    EXPECT_LT(context.getStats().heapBytes, heapBefore);
+
+    context.cleanup();
+}
+
+TEST(context, arraysTakeTheArrayTypeFoundOnce) {
+    Context context;
+    auto *env = new Environment(&context);
+    // Without 配列型 arrays have no type, and nothing is cached.
+    EXPECT_EQ(nullptr, context.newArrayValue(env)->parent);
+
+    auto arrayType = context.newDictionaryValue();
+    arrayType->set(L"名前", context.newStringValue(L"配列"));
+    env->bind(L"配列型", arrayType);
+    auto first = context.newArrayValue(env);
+    env->bind(L"配列型", context.newDictionaryValue());
+    auto second = context.newArrayValue(env);
+
+    EXPECT_EQ(arrayType, first->parent);
+    EXPECT_EQ(arrayType, second->parent);
+    EXPECT_EQ(L"配列", second->get(L"名前")->toStringValue()->value);
+    EXPECT_EQ(arrayType, second->getLookupSource(env));
+    EXPECT_FALSE(second->has(L"長さ"));
+
+    context.cleanup();
+}
+
+TEST(context, arrayElementsAreBoxedForBuiltins) {
+    Context context;
+    auto *env = new Environment(&context);
+    auto array = context.newArrayValue(env);
+    auto text = context.newStringValue(L"狸");
+    array->push(context.newNumberValue(1000000));
+    array->push(context.newFloatValue(2.5));
+    array->push(text);
+    array->push(context.newNoneValue());
+
+    EXPECT_EQ(1000000, array->getIndex(0)->toNumberValue()->value);
+    EXPECT_EQ(ValueType::NUM_FLOAT, array->getIndex(1)->type);
+    EXPECT_EQ(2.5, floatValueOf(array->getIndex(1)));
+    EXPECT_EQ(text, array->getIndex(2));
+    EXPECT_EQ(ValueType::NONE, array->getIndex(3)->type);
+    EXPECT_EQ(nullptr, array->getIndex(4));
+    EXPECT_EQ(nullptr, array->getIndex(-1));
+
+    array->set(0, context.newStringValue(L"語"));
+    EXPECT_EQ(L"語", array->getIndex(0)->toStringValue()->value);
+
+    context.cleanup();
+}
+
+TEST(context, singleCharactersAreShared) {
+    auto stringInput = StringInputSource(
+            L"文字列＝「狸の狸」\n"
+            L"最初＝文字列【０】\n"
+            L"最後＝文字列【２】\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+
+    Context context;
+    auto *env = new Environment(&context);
+    env->eval(tree);
+
+    EXPECT_EQ(context.newCharacterValue(L'狸'), env->lookup(L"最初"));
+    EXPECT_EQ(env->lookup(L"最初"), env->lookup(L"最後"));
+    EXPECT_EQ(L"の", context.newCharacterValue(L'の')->value);
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(context, countingLoopRunsInBoundedMemory) {
+    auto stringInput = StringInputSource(
+            L"関数、ループ（回数、合計）\n"
+            L"　もし、回数＝＝０\n"
+            L"　　返す、合計\n"
+            L"　返す、ループ（回数－１、合計＋１００００００）\n"
+            L"結果＝ループ（５０００、０）\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+
+    Context context;
+    context.setNurserySize(16 * 1024);
+    context.setMinimumHeap(16 * 1024);
+    auto *env = new Environment(&context);
+    env->eval(tree);
+
+    EXPECT_EQ(5000000000, env->lookup(L"結果")->toNumberValue()->value);
+    // Intermediate sums die young, so nothing accumulates in the old
+    // generation and no full collection is needed.
+    EXPECT_GT(context.getMinorCollectionCount(), 0);
+    EXPECT_EQ(context.getMinorCollectionCount(), context.getCollectionCount());
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(context, rootScopeKeepsValuesAliveUntilItEnds) {
+    Context context;
+    context.setFrequency(1);
+    auto *env = new Environment(&context);
+    {
+        RootScope roots(&context);
+        auto outer = roots.push(context.newStringValue(L"外"));
+        {
+            RootScope inner(&context);
+            auto value = inner.push(context.newStringValue(L"内"));
+            context.collect(env);
+            EXPECT_FALSE(value->young);
+            EXPECT_EQ(L"内", value->value);
+        }
+        context.newStringValue(L"ゴミ");
+        context.collect(env);
+        EXPECT_EQ(L"外", outer->value);
+    }
+    EXPECT_EQ(2, context.getMinorCollectionCount());
+    context.cleanup();
+}
+
+TEST(context, statsDescribeCollections) {
+    Context context;
+    context.setFrequency(1);
+    context.setMinimumHeap(1);
+    auto *env = new Environment(&context);
+    auto dictionary = context.newDictionaryValue();
+    dictionary->set(L"文字", context.newStringValue(L"生きている"));
+    env->bind(L"辞書", dictionary);
+    context.newStringValue(L"ゴミ");
+    context.collect(env);
+
+    auto stats = context.getStats();
+    EXPECT_EQ(2, stats.collections);
+    EXPECT_EQ(1, stats.minorCollections);
+    long pauses = 0;
+    for (auto count : stats.pauseHistogram) {
+        pauses += count;
+    }
+    EXPECT_EQ(1, pauses);
+    EXPECT_EQ((size_t) 1, stats.liveValues[(size_t) ValueType::DICT]);
+    EXPECT_EQ((size_t) 1, stats.liveValues[(size_t) ValueType::STRING]);
+    EXPECT_EQ((size_t) 1, stats.liveEnvironments);
+    EXPECT_GT(stats.liveBytes, (size_t) 0);
+    EXPECT_GE(stats.peakHeapBytes, stats.heapBytes);
+
+    context.cleanup();
+}
+
+TEST(context, inlineCacheFollowsShapes) {
+    Context context;
+    auto prototype = context.newDictionaryValue();
+    prototype->set(L"挨拶", context.newStringValue(L"こんにちは"));
+    auto first = context.newDictionaryValue();
+    auto second = context.newDictionaryValue();
+    for (auto dictionary : {first, second}) {
+        dictionary->set(L"名前", context.newStringValue(L"鈴木"));
+        dictionary->set(L"年", context.newNumberValue(30));
+        dictionary->setParent(prototype);
+    }
+
+    PropertyCache cache;
+    EXPECT_EQ(L"こんにちは", first->get(L"挨拶", cache)->toStringValue()->value);
+    EXPECT_EQ(L"こんにちは", second->get(L"挨拶", cache)->toStringValue()->value);
+    EXPECT_EQ((size_t) 1, cache.count);
+
+    // Shadowing the prototype's key changes the receiver's shape.
+    second->set(L"挨拶", context.newStringValue(L"どうも"));
+    EXPECT_EQ(L"どうも", second->get(L"挨拶", cache)->toStringValue()->value);
+    // Replacing the value in place keeps the prototype's shape.
+    prototype->set(L"挨拶", context.newStringValue(L"おはよう"));
+    EXPECT_EQ(L"おはよう", first->get(L"挨拶", cache)->toStringValue()->value);
+    EXPECT_EQ((size_t) 2, cache.count);
+
+    context.cleanup();
+}
+
+TEST(context, returnsAndTailCallsLeaveNothingPending) {
+    for (bool bytecode : {false, true}) {
+        auto stringInput = StringInputSource(
+                L"関数、ループ（回数、合計：０）\n"
+                L"　もし、回数＝＝０\n"
+                L"　　返す、合計\n"
+                L"　返す、ループ（回数－１、合計：合計＋２）\n"
+                L"結果＝ループ（３００）\n"
+                L"返す、結果＋１\n"
+        );
+        auto testTokenizer = InputSourceTokenizer(&stringInput);
+        auto parser = Parser(&testTokenizer, nullptr);
+        SyntaxNode *tree = parser.run();
+
+        Context context;
+        context.setBytecode(bytecode);
+        context.setFrequency(1);
+        auto *env = new Environment(&context);
+        Value *result = env->eval(tree);
+        EXPECT_EQ(Context::unwindSignal(), result);
+        EXPECT_EQ(601, context.completedValue(result)->toNumberValue()->value);
+
+        EXPECT_EQ(600, env->lookup(L"結果")->toNumberValue()->value);
+        EXPECT_EQ(Completion::NORMAL, context.completion.status);
+        EXPECT_EQ(nullptr, context.completion.value);
+        EXPECT_TRUE(context.completion.args.empty());
+        EXPECT_TRUE(context.completion.kwArgs.empty());
+
+        delete tree;
+        context.cleanup();
+    }
+}
@@ -10,7 +10,7 @@ TEST(coreFunctions, functionNewDictionary) {
     Context context;
     Environment env(&context);
     FunctionNewDictionary f;
-    unordered_map<wstring, Value *> kwargs(
+    unordered_map<Symbol, Value *> kwargs(
             {
                     {wstring(L"hello"), context.newNumberValue(7)}
             });
@@ -23,3 +23,19 @@ TEST(coreFunctions, functionNewDictionary) {
 
     context.cleanup();
 }
+
+TEST(coreFunctions, functionMemoryStats) {
+    Context context;
+    Environment env(&context);
+    FunctionMemoryStats f;
+    auto result = f.apply({}, &env, nullptr);
+
+    EXPECT_EQ(ValueType::DICT, result->type);
+    auto dict = result->toDictionaryValue();
+    EXPECT_EQ(0, dict->get(L"掃除回数")->toNumberValue()->value);
+    EXPECT_EQ(ValueType::ARRAY, dict->get(L"停止分布")->type);
+    EXPECT_EQ(ValueType::DICT, dict->get(L"型別")->type);
+    EXPECT_EQ(0, dict->get(L"型別")->toDictionaryValue()->get(L"STRING")->toNumberValue()->value);
+
+    context.cleanup();
+}
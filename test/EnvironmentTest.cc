@@ -248,6 +248,139 @@ TEST(program, if_elif_else) {
     EXPECT_TRUE(env.lookup(L"う")->equals(new NumberValue(0)));
 }
 
+TEST(program, tail_calls) {
+    // Deep enough to overflow the stack unless every call below is made as
+    // a tail call.
+    auto stringInput = StringInputSource(
+            L"関数、偶数（数）\n"
+            L"　もし、数＝＝０\n"
+            L"　　返す、１\n"
+            L"　返す、奇数（数－１）\n"
+            L"関数、奇数（数）\n"
+            L"　もし、数＝＝０\n"
+            L"　　返す、０\n"
+            L"　返す、偶数（数－１）\n"
+            L"数え＝辞書（）\n"
+            L"関数、数え・下る（自分、数、合計）\n"
+            L"　もし、数＞０\n"
+            L"　　もし、合計＞＝０\n"
+            L"　　　返す、自分〜下る（数－１、合計＋１）\n"
+            L"　返す、合計\n"
+            L"関数、捨てる（数）\n"
+            L"　もし、数＞０\n"
+            L"　　捨てる（数－１）\n"
+            L"　その他\n"
+            L"　　返す、５\n"
+            L"あ＝偶数（３０００００）\n"
+            L"い＝奇数（３）\n"
+            L"う＝数え〜下る（３０００００、０）\n"
+            L"え＝捨てる（３）\n"
+            L"お＝捨てる（０）\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+    Context context;
+    auto *env = new Environment(&context);
+    env->eval(tree);
+
+    EXPECT_EQ(1, env->lookup(L"あ")->toNumberValue()->value);
+    EXPECT_EQ(1, env->lookup(L"い")->toNumberValue()->value);
+    EXPECT_EQ(300000, env->lookup(L"う")->toNumberValue()->value);
+    // A call statement's value is dropped even when it is made as a tail
+    // call.
+    EXPECT_EQ(ValueType::NONE, env->lookup(L"え")->type);
+    EXPECT_EQ(5, env->lookup(L"お")->toNumberValue()->value);
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(program, recursion_past_the_native_stack_fails) {
+    // Too deep for the native stack long before the maximum call depth.
+    auto stringInput = StringInputSource(
+            L"関数、無限（数）\n"
+            L"　返す、無限（数＋１）＋１\n"
+            L"結果＝無限（０）\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+    Context context;
+    auto *env = new Environment(&context);
+    auto result = env->eval(tree);
+
+    // The error unwinds the whole program instead of crashing it.
+    EXPECT_EQ(ValueType::NONE, context.completedValue(result)->type);
+    EXPECT_EQ(ValueType::NONE, env->lookup(L"結果")->type);
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(program, loops) {
+    auto stringInput = StringInputSource(
+            L"合計＝０\n"
+            L"繰り返す、番、１、５\n"
+            L"　合計＝合計＋番\n"
+            L"回数＝０\n"
+            L"繰り返す、回数＜３\n"
+            L"　回数＝回数＋１\n"
+            L"関数、探す（言葉、文字）\n"
+            L"　繰り返す、番、０、長さ（言葉）\n"
+            L"　　もし、言葉【番】＝＝文字\n"
+            L"　　　返す、番\n"
+            L"　返す、－１\n"
+            L"あ＝探す（「狸語です」、「語」）\n"
+            L"い＝探す（「狸語です」、「英」）\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+    Context context;
+    auto *env = new Environment(&context);
+    env->eval(tree);
+
+    EXPECT_EQ(10, env->lookup(L"合計")->toNumberValue()->value);
+    EXPECT_EQ(4, env->lookup(L"番")->toNumberValue()->value);
+    EXPECT_EQ(3, env->lookup(L"回数")->toNumberValue()->value);
+    EXPECT_EQ(1, env->lookup(L"あ")->toNumberValue()->value);
+    EXPECT_EQ(-1, env->lookup(L"い")->toNumberValue()->value);
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(program, loopsCountWithoutAllocating) {
+    auto stringInput = StringInputSource(
+            L"繰り返す、番、０、３０００\n"
+            L"　零＝０\n"
+            L"合計＝０\n"
+            L"繰り返す、番、１０００、１０１０\n"
+            L"　合計＝合計＋番\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+    Context context;
+    auto *env = new Environment(&context);
+    size_t before = context.getBytesSinceCollection();
+    env->eval(tree->children[0]);
+
+    // Only the bound ３０００ is made; counting past the shared small
+    // numbers does not make new ones.
+    EXPECT_EQ(sizeof(NumberValue), context.getBytesSinceCollection() - before);
+    EXPECT_EQ(2999, env->lookup(L"番")->toNumberValue()->value);
+    env->eval(tree);
+    EXPECT_EQ(10045, env->lookup(L"合計")->toNumberValue()->value);
+
+    env->bind(L"番", context.newStringValue(L"番号"));
+    EXPECT_EQ(L"番号", env->lookup(L"番")->toStringValue()->value);
+
+    delete tree;
+    context.cleanup();
+}
+
 TEST(eval, user_function_varargs) {
     auto stringInput = StringInputSource(
             L"関数、ほげ（引数、＊配列引数、＊＊辞書引数）\n"
@@ -330,6 +463,30 @@ TEST(eval, infix) {
     EXPECT_EQ(numValue->value, 2);
 }
 
+TEST(eval, infix_mixed_numbers) {
+    auto stringInput = StringInputSource(
+            L"あ＝１＋０。５\n"
+            L"い＝２。５－１\n"
+            L"う＝３＊０。５\n"
+            L"え＝３／２。０\n"
+            L"お＝２＞１。５\n"
+            L"か＝１。５＜＝１\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+    Context context;
+    Environment env(&context);
+    env.eval(tree);
+
+    EXPECT_TRUE(FloatValue(1.5).equals(env.lookup(L"あ")));
+    EXPECT_TRUE(FloatValue(1.5).equals(env.lookup(L"い")));
+    EXPECT_TRUE(FloatValue(1.5).equals(env.lookup(L"う")));
+    EXPECT_TRUE(FloatValue(1.5).equals(env.lookup(L"え")));
+    EXPECT_TRUE(env.lookup(L"お")->isTruthy());
+    EXPECT_FALSE(env.lookup(L"か")->isTruthy());
+}
+
 TEST(eval, infix_equality) {
     auto stringInput = StringInputSource(
             L"あ＝１＝＝３\n"
@@ -40,6 +40,40 @@ TEST(stringInputSource, readSingleCharacters) {
     EXPECT_TRUE(stringInput.eof());
 }
 
+TEST(utf8InputSource, readsCharactersFromUTF8) {
+    auto text = string("関n数𠮷\xff");
+    auto utf8Input = UTF8InputSource(text);
+
+    EXPECT_EQ(utf8Input.peekChar(), L'関');
+    EXPECT_EQ(utf8Input.getChar(), L'関');
+    EXPECT_EQ(utf8Input.getChar(), L'n');
+    EXPECT_EQ(utf8Input.peekChar(), L'数');
+    EXPECT_EQ(utf8Input.getChar(), L'数');
+    EXPECT_EQ(utf8Input.getChar(), L'𠮷');
+    EXPECT_EQ(utf8Input.getChar(), (wchar_t) 0xFFFD);
+    EXPECT_FALSE(utf8Input.eof());
+
+    // 終わり
+    EXPECT_EQ(utf8Input.peekChar(), L'\0');
+    EXPECT_EQ(utf8Input.getChar(), L'\0');
+    EXPECT_TRUE(utf8Input.eof());
+}
+
+TEST(utf8InputSource, tokenizesLikeAStringSource) {
+    auto text = string("あ＝「たぬき」\n");
+    auto utf8Input = UTF8InputSource(text);
+    auto utf8Tokenizer = InputSourceTokenizer(&utf8Input);
+    auto stringInput = StringInputSource(L"あ＝「たぬき」\n");
+    auto stringTokenizer = InputSourceTokenizer(&stringInput);
+
+    for (int i = 0; i < 5; i++) {
+        auto expected = stringTokenizer.getToken();
+        auto actual = utf8Tokenizer.getToken();
+        EXPECT_EQ(expected.type, actual.type);
+        EXPECT_EQ(expected.content, actual.content);
+    }
+}
+
 TEST(stringInputSource, fileSource) {
     auto filename = string("../example/fileInputSource.pin");
     FileInputSource stringInput(filename.c_str());
@@ -0,0 +1,93 @@
+#include "gtest/gtest.h"
+#include "Tokenizer.h"
+#include "Parser.h"
+#include "Context.h"
+#include "Optimizer.h"
+
+static SyntaxNode *parseOptimized(Context *context, const wchar_t *source) {
+    auto stringInput = StringInputSource(source);
+    auto tokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&tokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+    Optimizer(context).optimize(tree);
+    return tree;
+}
+
+TEST(optimizer, foldsLiteralOperations) {
+    Context context;
+    SyntaxNode *tree = parseOptimized(&context,
+            L"あ＝１０＋２＊３\n"
+            L"い＝「狸」＋「語」\n"
+            L"う＝１。５＋２。５\n"
+            L"え＝５＞３\n"
+            L"お＝あ＋１\n"
+            L"か＝１／０\n");
+
+    auto a = tree->children[0]->children[1];
+    EXPECT_EQ(NodeType::TERMINAL, a->type);
+    EXPECT_EQ(16, a->constant->toNumberValue()->value);
+    EXPECT_EQ(L"狸語", tree->children[1]->children[1]->constant->toStringValue()->value);
+    EXPECT_EQ(4.0, ((FloatValue *) tree->children[2]->children[1]->constant)->value);
+    EXPECT_EQ(1, tree->children[3]->children[1]->constant->toNumberValue()->value);
+    EXPECT_EQ(NodeType::ADD, tree->children[4]->children[1]->type);
+    EXPECT_EQ(NodeType::DIV, tree->children[5]->children[1]->type);
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(optimizer, foldsMixedNumericEquality) {
+    Context context;
+    SyntaxNode *tree = parseOptimized(&context,
+            L"あ＝１＝＝１。０\n"
+            L"い＝２。５！＝２\n"
+            L"う＝２＝＝２。５\n");
+
+    EXPECT_EQ(1, tree->children[0]->children[1]->constant->toNumberValue()->value);
+    EXPECT_EQ(1, tree->children[1]->children[1]->constant->toNumberValue()->value);
+    EXPECT_EQ(0, tree->children[2]->children[1]->constant->toNumberValue()->value);
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(optimizer, dropsBranchesWithConstantConditions) {
+    Context context;
+    SyntaxNode *tree = parseOptimized(&context,
+            L"もし、１＞２\n"
+            L"　あ＝１\n"
+            L"あるいは、い\n"
+            L"　あ＝２\n"
+            L"あるいは、「真」\n"
+            L"　あ＝３\n"
+            L"その他\n"
+            L"　あ＝４\n");
+
+    auto branches = tree->children[0]->children;
+    ASSERT_EQ((size_t) 3, branches.size());
+    EXPECT_EQ(L"い", branches[0]->content.content);
+    EXPECT_EQ(3, branches[2]->children[0]->children[1]->constant->toNumberValue()->value);
+
+    delete tree;
+    context.cleanup();
+}
+
+TEST(optimizer, literalsAreEvaluatedOnceAndOutliveCollections) {
+    Context context;
+    context.setFrequency(1);
+    auto *env = new Environment(&context);
+    SyntaxNode *tree = parseOptimized(&context, L"文字＝「狸」\n");
+
+    env->eval(tree);
+    auto first = env->lookup(L"文字");
+    context.collect(env);
+    env->eval(tree);
+    EXPECT_EQ(first, env->lookup(L"文字"));
+
+    // Once the tree is gone the value lives on as long as it is reachable.
+    delete tree;
+    context.collect(env);
+    EXPECT_EQ(L"狸", env->lookup(L"文字")->toStringValue()->value);
+
+    context.cleanup();
+}
@@ -541,6 +541,42 @@ TEST(parsing_subscript, subscript_set) {
     EXPECT_EQ(expectedTree, *tree->children[0]);
 }
 
+TEST(parsing_loop, loops) {
+    auto stringInput = StringInputSource(
+            L"繰り返す、あ＜３\n"
+            L"　表示（あ）\n"
+            L"繰り返す、番、０、い\n"
+            L"　表示（番）\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+    string treeString = tree->children[0]->toString() + tree->children[1]->toString();
+    string expected = (
+            u8"LOOP\n"
+            u8" LT\n"
+            u8"  TERMINAL symbol：”あ”、1行目\n"
+            u8"  TERMINAL number：”３（3）”、1行目\n"
+            u8" TEXT\n"
+            u8"  CALL\n"
+            u8"   TERMINAL symbol：”表示”、2行目\n"
+            u8"   CALL_TAIL\n"
+            u8"    ARGS\n"
+            u8"     TERMINAL symbol：”あ”、2行目\n"
+            u8"RANGE_LOOP\n"
+            u8" TERMINAL symbol：”番”、3行目\n"
+            u8" TERMINAL number：”０（0）”、3行目\n"
+            u8" TERMINAL symbol：”い”、3行目\n"
+            u8" TEXT\n"
+            u8"  CALL\n"
+            u8"   TERMINAL symbol：”表示”、4行目\n"
+            u8"   CALL_TAIL\n"
+            u8"    ARGS\n"
+            u8"     TERMINAL symbol：”番”、4行目\n"
+    );
+    EXPECT_EQ(expected, treeString);
+}
+
 TEST(parsing_nonlocal, external_sotogawa) {
     auto stringInput = StringInputSource(
             L"外側、私の変数名"
@@ -0,0 +1,82 @@
+#include "gtest/gtest.h"
+#include "Symbol.h"
+#include "Tokenizer.h"
+#include "Parser.h"
+#include "Environment.h"
+#include "Context.h"
+#include "CoreFunctions.h"
+
+TEST(symbol, equalNamesShareOneId) {
+    Symbol first(L"名前");
+    Symbol second(wstring(L"名") + L"前");
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(first.getId(), second.getId());
+    EXPECT_NE(first, Symbol(L"名無し"));
+    EXPECT_EQ(L"名前", second.name());
+    EXPECT_TRUE(Symbol().empty());
+    EXPECT_TRUE(Symbol(L"").empty());
+
+    size_t count = Symbol::count();
+    Symbol(L"名前");
+    EXPECT_EQ(count, Symbol::count());
+}
+
+TEST(symbol, identifierTokensAreInterned) {
+    auto stringInput = StringInputSource(L"名前＝「名前」");
+    auto tokenizer = InputSourceTokenizer(&stringInput);
+    auto name = tokenizer.getToken();
+    tokenizer.getToken();
+    auto string = tokenizer.getToken();
+    EXPECT_EQ(Symbol(L"名前"), name.symbol);
+    EXPECT_TRUE(string.symbol.empty());
+}
+
+TEST(symbol, findDoesNotIntern) {
+    Symbol found;
+    EXPECT_TRUE(Symbol::find(L"名前", &found));
+    EXPECT_EQ(Symbol(L"名前"), found);
+
+    size_t count = Symbol::count();
+    EXPECT_FALSE(Symbol::find(L"見つからない名前", &found));
+    EXPECT_EQ(count, Symbol::count());
+}
+
+TEST(symbol, runtimeDictionaryKeysAreNotInterned) {
+    auto stringInput = StringInputSource(
+            L"辞書１＝辞書（）\n"
+            L"鍵＝「鍵」\n"
+            L"繰り返す、番、０、１００\n"
+            L"　鍵＝鍵＋「ー」\n"
+            L"　辞書１【鍵】＝番\n"
+            L"辞書１【「名前」】＝「なまえ」\n"
+            L"あ＝辞書１【「鍵」＋「ーーーーー」】\n"
+            L"い＝辞書調べ（辞書１、鍵）\n"
+            L"う＝辞書１・名前\n"
+    );
+    auto tokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&tokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+    Context context;
+    auto *env = new Environment(&context);
+    initModule(env);
+    size_t count = Symbol::count();
+    env->eval(tree);
+
+    EXPECT_EQ(count, Symbol::count());
+    EXPECT_EQ(4, env->lookup(L"あ")->toNumberValue()->value);
+    EXPECT_EQ(99, env->lookup(L"い")->toNumberValue()->value);
+    EXPECT_EQ(L"なまえ", env->lookup(L"う")->toStringValue()->value);
+
+    // A key stored before it became a name is found and replaced through
+    // the name.
+    auto dictionary = env->lookup(L"辞書１")->toDictionaryValue();
+    EXPECT_EQ((size_t) 101, dictionary->size());
+    Symbol later(L"鍵ーーー");
+    EXPECT_EQ(2, dictionary->get(later)->toNumberValue()->value);
+    dictionary->set(later, context.newNumberValue(20));
+    EXPECT_EQ(20, dictionary->getEntry(CompactString(L"鍵ーーー"))->toNumberValue()->value);
+    EXPECT_EQ((size_t) 101, dictionary->size());
+
+    delete tree;
+    context.cleanup();
+}
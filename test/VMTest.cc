@@ -0,0 +1,440 @@
+#include "gtest/gtest.h"
+#include "Tokenizer.h"
+#include "Parser.h"
+#include "Environment.h"
+#include "Context.h"
+#include "Compiler.h"
+#include "Optimizer.h"
+
+static Value *evalBytecode(Environment *env, const wchar_t *source) {
+    auto stringInput = StringInputSource(source);
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+    Value *result;
+    if (tree->children.size() == 1) {
+        result = env->eval(tree->children[0]);
+    } else {
+        result = env->eval(tree);
+    }
+    delete tree;
+    return result;
+}
+
+TEST(vm, expression) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+
+    auto v = evalBytecode(env, L"足す（２、引く（５、２）、４）＊３");
+    EXPECT_EQ(ValueType::NUM, v->type);
+    EXPECT_EQ(27, v->toNumberValue()->value);
+
+    v = evalBytecode(env, L"「あい」＋「う」");
+    EXPECT_EQ(L"あいう", v->toStringValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, functionsAndConditions) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"関数、フィボ（数）\n"
+            L"　もし、数＜２\n"
+            L"　　返す、数\n"
+            L"　返す、フィボ（数－１）＋フィボ（数－２）\n"
+            L"関数、分類（数）\n"
+            L"　もし、数＝＝０\n"
+            L"　　返す、「零」\n"
+            L"　あるいは、数＜０\n"
+            L"　　返す、「負」\n"
+            L"　その他\n"
+            L"　　返す、「正」\n"
+            L"結果＝フィボ（２０）\n"
+            L"分類一＝分類（０）\n"
+            L"分類二＝分類（－３）\n"
+            L"分類三＝分類（３）\n"
+    );
+
+    EXPECT_EQ(6765, env->lookup(L"結果")->toNumberValue()->value);
+    EXPECT_EQ(L"零", env->lookup(L"分類一")->toStringValue()->value);
+    EXPECT_EQ(L"負", env->lookup(L"分類二")->toStringValue()->value);
+    EXPECT_EQ(L"正", env->lookup(L"分類三")->toStringValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, parameters) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"関数、引数（あ、い：２＋３、＊残り、＊＊名前付き）\n"
+            L"　返す、あ＋い＋長さ（残り）＋名前付き・う\n"
+            L"結果一＝引数（１、う：１００）\n"
+            L"結果二＝引数（１、７、８、い：１０、う：１０００）\n"
+    );
+
+    EXPECT_EQ(106, env->lookup(L"結果一")->toNumberValue()->value);
+    EXPECT_EQ(1013, env->lookup(L"結果二")->toNumberValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, selfTailCallsRunInConstantStack) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"関数、ループ（回数、合計）\n"
+            L"　もし、回数＝＝０\n"
+            L"　　返す、合計\n"
+            L"　返す、ループ（回数－１、合計＋２）\n"
+            L"結果＝ループ（１０００００、０）\n"
+    );
+
+    EXPECT_EQ(200000, env->lookup(L"結果")->toNumberValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, tailCallsRunInConstantStack) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"関数、偶数（数）\n"
+            L"　もし、数＝＝０\n"
+            L"　　返す、１\n"
+            L"　返す、奇数（数－１）\n"
+            L"関数、奇数（数）\n"
+            L"　もし、数＝＝０\n"
+            L"　　返す、０\n"
+            L"　返す、偶数（数－１）\n"
+            L"数え＝辞書（）\n"
+            L"関数、数え・下る（自分、数、合計）\n"
+            L"　もし、数＞０\n"
+            L"　　もし、合計＞＝０\n"
+            L"　　　返す、自分〜下る（数－１、合計＋１）\n"
+            L"　返す、合計\n"
+            L"関数、捨てる（数）\n"
+            L"　もし、数＞０\n"
+            L"　　捨てる（数－１）\n"
+            L"　その他\n"
+            L"　　返す、５\n"
+            L"あ＝偶数（３０００００）\n"
+            L"い＝奇数（３）\n"
+            L"う＝数え〜下る（３０００００、０）\n"
+            L"え＝捨てる（３）\n"
+            L"お＝捨てる（０）\n"
+    );
+
+    EXPECT_EQ(1, env->lookup(L"あ")->toNumberValue()->value);
+    EXPECT_EQ(1, env->lookup(L"い")->toNumberValue()->value);
+    EXPECT_EQ(300000, env->lookup(L"う")->toNumberValue()->value);
+    EXPECT_EQ(ValueType::NONE, env->lookup(L"え")->type);
+    EXPECT_EQ(5, env->lookup(L"お")->toNumberValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, deepRecursionRunsOnHeapFrames) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"関数、深い（数）\n"
+            L"　もし、数＝＝０\n"
+            L"　　返す、０\n"
+            L"　返す、深い（数－１）＋１\n"
+            L"結果＝深い（２０００００）\n"
+    );
+
+    EXPECT_EQ(200000, env->lookup(L"結果")->toNumberValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, recursionPastMaxDepthFails) {
+    Context context;
+    context.setBytecode(true);
+    context.setMaxCallDepth(1000);
+    auto *env = new Environment(&context);
+    auto result = evalBytecode(env,
+            L"関数、無限（数）\n"
+            L"　返す、無限（数＋１）＋１\n"
+            L"結果＝無限（０）\n"
+    );
+
+    // The error unwinds the whole program, which ends with None.
+    EXPECT_EQ(Context::unwindSignal(), result);
+    EXPECT_EQ(ValueType::NONE, context.completedValue(result)->type);
+    EXPECT_EQ(ValueType::NONE, env->lookup(L"結果")->type);
+
+    // Later programs run normally.
+    evalBytecode(env, L"結果＝無限\n");
+    EXPECT_EQ(ValueType::FUNC, env->lookup(L"結果")->type);
+
+    context.cleanup();
+}
+
+TEST(vm, loops) {
+    Context context;
+    context.setBytecode(true);
+    context.setFrequency(1);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"関数、逆（言葉）\n"
+            L"　結果＝「」\n"
+            L"　回数＝長さ（言葉）\n"
+            L"　繰り返す、回数＞０\n"
+            L"　　回数＝回数－１\n"
+            L"　　結果＝結果＋言葉【回数】\n"
+            L"　返す、結果\n"
+            L"関数、合計（まで）\n"
+            L"　あ＝０\n"
+            L"　繰り返す、番、０、まで\n"
+            L"　　もし、番＝＝１０\n"
+            L"　　　返す、あ\n"
+            L"　　あ＝あ＋番\n"
+            L"　返す、あ\n"
+            L"結果一＝逆（「狸語です」）\n"
+            L"結果二＝合計（５）\n"
+            L"結果三＝合計（１００）\n"
+            L"結果四＝合計（「五」）\n"
+    );
+
+    EXPECT_EQ(L"すで語狸", env->lookup(L"結果一")->toStringValue()->value);
+    EXPECT_EQ(10, env->lookup(L"結果二")->toNumberValue()->value);
+    EXPECT_EQ(45, env->lookup(L"結果三")->toNumberValue()->value);
+    EXPECT_EQ(0, env->lookup(L"結果四")->toNumberValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, dictionariesAndSubscripts) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"あ＝辞書（名前：「鈴木」）\n"
+            L"い＝辞書（中：辞書（あ：「い」））\n"
+            L"い【「中」】・あ＝「う」\n"
+            L"あ・年＝３０\n"
+            L"あ【「町」】＝「東京」\n"
+            L"関数、あ・挨拶（自分）\n"
+            L"　返す、自分・名前＋「です」\n"
+            L"結果一＝い【「中」】・あ\n"
+            L"結果二＝あ・年＋あ【「年」】\n"
+            L"結果三＝あ〜挨拶（）\n"
+            L"結果四＝「狸語」【１】\n"
+            L"結果五＝あ・無い・名前\n"
+            L"結果六＝あ【「町」】\n"
+    );
+
+    EXPECT_EQ(L"う", env->lookup(L"結果一")->toStringValue()->value);
+    EXPECT_EQ(60, env->lookup(L"結果二")->toNumberValue()->value);
+    EXPECT_EQ(L"鈴木です", env->lookup(L"結果三")->toStringValue()->value);
+    EXPECT_EQ(L"語", env->lookup(L"結果四")->toStringValue()->value);
+    EXPECT_EQ(ValueType::NONE, env->lookup(L"結果五")->type);
+    EXPECT_EQ(L"東京", env->lookup(L"結果六")->toStringValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, closuresAndNonlocals) {
+    Context context;
+    context.setBytecode(true);
+    context.setFrequency(1);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"関数、数える（）\n"
+            L"　回数＝０\n"
+            L"　関数、次（）\n"
+            L"　　外側、回数\n"
+            L"　　回数＝回数＋１\n"
+            L"　　返す、回数\n"
+            L"　返す、次\n"
+            L"数え＝数える（）\n"
+            L"数え（）\n"
+            L"数え（）\n"
+            L"結果＝数え（）\n"
+    );
+
+    EXPECT_EQ(3, env->lookup(L"結果")->toNumberValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, unboundSlotsFallBackToEnclosingScopes) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"回数＝１０\n"
+            L"関数、影（）\n"
+            L"　前＝回数\n"
+            L"　回数＝回数＋１\n"
+            L"　関数、中（）\n"
+            L"　　返す、前＋回数\n"
+            L"　返す、中（）\n"
+            L"結果＝影（）\n"
+    );
+
+    EXPECT_EQ(21, env->lookup(L"結果")->toNumberValue()->value);
+    EXPECT_EQ(10, env->lookup(L"回数")->toNumberValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, failedLookupSkipsRestOfChain) {
+    auto stringInput = StringInputSource(L"あ・い・う（１）");
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+
+    Compiler compiler;
+    Code *code = compiler.compile(tree->children[0]);
+    vector<Op> ops;
+    for (auto &instruction : code->instructions) {
+        ops.push_back(instruction.op);
+    }
+    vector<Op> expected = {Op::LOAD_NAME, Op::GET, Op::GET, Op::LOAD_NUMBER, Op::CALL, Op::RESULT};
+    EXPECT_EQ(expected, ops);
+    for (size_t i = 1; i <= 4; i++) {
+        if (ops[i] != Op::LOAD_NUMBER) {
+            EXPECT_EQ((uint32_t) 5, code->instructions[i].target);
+        }
+    }
+
+    delete code;
+    delete tree;
+}
+
+TEST(vm, arithmeticQuickensAndFallsBack) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"関数、足し算（あ、い）\n"
+            L"　返す、あ＋い\n"
+            L"整数＝足し算（２、３）\n"
+            L"小数＝足し算（２、０。５）\n"
+            L"文字＝足し算（「狸」、「語」）\n"
+    );
+
+    EXPECT_EQ(5, env->lookup(L"整数")->toNumberValue()->value);
+    EXPECT_TRUE(FloatValue(2.5).equals(env->lookup(L"小数")));
+    EXPECT_EQ(L"狸語", env->lookup(L"文字")->toStringValue()->value);
+
+    auto function = (UserFunctionValue *) env->lookup(L"足し算");
+    const Instruction *add = nullptr;
+    for (auto &instruction : function->code->instructions) {
+        if (instruction.op == Op::ADD || instruction.op == Op::ADD_INT) {
+            add = &instruction;
+        }
+    }
+    // Quickened for integers first, then put back to the generic form.
+    ASSERT_NE(nullptr, add);
+    EXPECT_EQ(Op::ADD, add->op);
+    EXPECT_TRUE(add->deoptimized);
+    EXPECT_EQ(0, add->depth);
+
+    context.cleanup();
+}
+
+TEST(vm, numbersStayUnboxedUntilTheyOutgrowAWord) {
+    Context context;
+    context.setBytecode(true);
+    context.setNurserySize(16 * 1024);
+    context.setMinimumHeap(16 * 1024);
+    auto *env = new Environment(&context);
+    evalBytecode(env,
+            L"関数、合計（回数）\n"
+            L"　結果＝０\n"
+            L"　繰り返す、数、０、回数\n"
+            L"　　結果＝結果＋数＊２\n"
+            L"　返す、結果\n"
+            L"関数、倍（あ）\n"
+            L"　返す、あ＋あ\n"
+            L"小さい＝合計（１０００００）\n"
+            L"大きい＝倍（１４０７３７４８８３５５３２８）\n"
+            L"負＝倍（－１４０７３７４８８３５５３２９）\n"
+    );
+
+    // Counters and sums live in frame slots and on the stack as words, so
+    // the loop allocates nothing and never reaches a collection.
+    EXPECT_EQ(0, context.getCollectionCount());
+    EXPECT_EQ(9999900000, env->lookup(L"小さい")->toNumberValue()->value);
+    EXPECT_EQ(281474976710656, env->lookup(L"大きい")->toNumberValue()->value);
+    EXPECT_EQ(-281474976710658, env->lookup(L"負")->toNumberValue()->value);
+
+    context.cleanup();
+}
+
+TEST(vm, treesKeepTheirCodeAndFunctionsTheirBodies) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+    auto stringInput = StringInputSource(
+            L"関数、二倍（数）\n"
+            L"　返す、数＊２\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+
+    env->eval(tree);
+    const Code *code = tree->code.get();
+    env->eval(tree);
+    EXPECT_EQ(code, tree->code.get());
+
+    // The function outlives the tree it was defined in.
+    weak_ptr<const Code> body = ((UserFunctionValue *) env->lookup(L"二倍"))->code;
+    delete tree;
+    EXPECT_EQ(42, evalBytecode(env, L"二倍（２１）")->toNumberValue()->value);
+
+    // Every collection from here on is a full one.
+    context.setGrowthFactor(1);
+    context.setMinimumHeap(0);
+    context.setFrequency(1);
+    evalBytecode(env, L"二倍＝０\n");
+    context.collect(env);
+    // Dead functions are destroyed when their slab is swept, which the next
+    // function allocated does first.
+    evalBytecode(env, L"関数、三倍（数）\n　返す、数＊３\n");
+    EXPECT_TRUE(body.expired());
+
+    context.cleanup();
+}
+
+TEST(vm, functionsKeepTheirConstantsAfterTheirTreeIsDeleted) {
+    Context context;
+    context.setBytecode(true);
+    auto *env = new Environment(&context);
+    // As in a pikatanuki session, where every message is a tree of its own
+    // that is deleted once it has run.
+    auto stringInput = StringInputSource(
+            L"関数、名前（）\n"
+            L"　返す、「たぬき」\n"
+    );
+    auto testTokenizer = InputSourceTokenizer(&stringInput);
+    auto parser = Parser(&testTokenizer, nullptr);
+    SyntaxNode *tree = parser.run();
+    Optimizer(&context).optimize(tree);
+    env->eval(tree);
+    delete tree;
+
+    // Every collection from here on is a full one, and the strings made
+    // after it sweep the slab the constant was in.
+    context.setGrowthFactor(1);
+    context.setMinimumHeap(0);
+    context.setFrequency(1);
+    evalBytecode(env, L"ゴミ＝「ゴ」＋「ミ」\n");
+
+    EXPECT_EQ(L"たぬき", evalBytecode(env, L"名前（）")->toStringValue()->value);
+
+    context.cleanup();
+}